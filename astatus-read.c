@@ -0,0 +1,112 @@
+/*
+astatus-read: print the values in astatus's snapshot (see astatus.h)
+
+Each value is printed on its own line as a name and the value(s), e.g.,
+"mem.available 4128768000" or "battery.BAT0 87 discharging 208", so
+scripts can pick out what they need with grep or awk instead of parsing
+astatus's line.
+*/
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "astatus.h"
+
+static char *argv0 = "astatus-read";
+
+/* Print to stderr & exit. From
+https://git.suckless.org/dmenu/file/util.c.html#l10. */
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: ", argv0);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (fmt[0] && fmt[strlen(fmt) - 1] == ':') {
+		fputc(' ', stderr);
+		perror(NULL);
+	} else {
+		fputc('\n', stderr);
+	}
+	exit(1);
+}
+
+static const char *
+statusstr(int32_t status)
+{
+	static const char *const statuses[] = {
+		[ASTATUS_UNKNOWN] = "unknown",
+		[ASTATUS_CHARGING] = "charging",
+		[ASTATUS_DISCHARGING] = "discharging",
+		[ASTATUS_NOT_CHARGING] = "notcharging",
+		[ASTATUS_FULL] = "full",
+	};
+
+	if (status < 0 || (size_t)status >= sizeof(statuses)
+			/ sizeof(statuses[0]))
+		return "unknown";
+	return statuses[status];
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t i;
+	const struct astatus_snapshot *shm;
+	struct astatus_snapshot snap;
+	char name[ASTATUS_SHM_SIZE];
+
+	argv0 = argv[0];
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv0);
+		return 1;
+	}
+	astatus_shmname(name, getuid());
+	if ((shm = astatus_open(getuid())) == NULL)
+		die("%s:", name);
+	if (astatus_read(shm, &snap) < 0)
+		die("%s: The snapshot is inconsistent", name);
+	if (snap.version != ASTATUS_SNAPSHOT_VERSION)
+		die("%s: Version %" PRIu32 " isn't supported", name,
+				snap.version);
+
+	printf("updated %" PRId64 "\n", snap.updated);
+	printf("mem.total %" PRIu64 "\n", snap.memtotal);
+	printf("mem.available %" PRIu64 "\n", snap.memavailable);
+	printf("load %" PRIu32 ".%02" PRIu32 " %" PRIu32 ".%02" PRIu32
+			" %" PRIu32 ".%02" PRIu32 "\n",
+			snap.load[0] / 100, snap.load[0] % 100,
+			snap.load[1] / 100, snap.load[1] % 100,
+			snap.load[2] / 100, snap.load[2] % 100);
+	if (snap.volume >= 0)
+		printf("volume %" PRId32 " %s\n", snap.volume,
+				snap.muted ? "muted" : "unmuted");
+	for (i = 0; i < snap.ndisks && i < ASTATUS_DISKS; i++)
+		printf("disk.%.*s %" PRIu64 " %" PRIu64 "\n", ASTATUS_NAME,
+				snap.disks[i].name, snap.disks[i].size,
+				snap.disks[i].avail);
+	for (i = 0; i < snap.nbatteries && i < ASTATUS_BATTERIES; i++)
+		printf("battery.%.*s %" PRId32 " %s %" PRId32 "\n",
+				ASTATUS_NAME, snap.batteries[i].name,
+				snap.batteries[i].capacity,
+				statusstr(snap.batteries[i].status),
+				snap.batteries[i].minutesleft);
+	for (i = 0; i < snap.nwifi && i < ASTATUS_WIFI; i++) {
+		if (snap.wifi[i].connected)
+			printf("wifi.%.*s %" PRId32 " %" PRIu32 "\n",
+					ASTATUS_NAME, snap.wifi[i].name,
+					snap.wifi[i].signal,
+					snap.wifi[i].bitrate);
+		else
+			printf("wifi.%.*s disconnected\n", ASTATUS_NAME,
+					snap.wifi[i].name);
+	}
+	return 0;
+}
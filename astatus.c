@@ -3,29 +3,59 @@ adaptive status line
 
 The basic idea for the program is as follows:
 
-- Define functions that collect status information and print them to a
-stream (FILE *).
+- Define functions that collect status information and append them to
+a string builder (struct strbuf).
 - Put those functions into an array so they can be iterated over.
-- Pass either stdout (for -s) or buffer in memory (via fmemopen(3))
-that will be used to set WM_NAME (for -x) to each function.
-- Call the functions in a loop, wait a few seconds or until USR1 is
-received between each iteration, repeating until TERM or INT is received.
+- Give each function its own string builder to keep its text in, and
+only call it again when its refresh interval is up.
+- Put the text together in another string builder and write it to
+either stdout (for -s) or WM_NAME (for -x).
+- Call the functions in a loop, waiting in an event loop until a few
+seconds have passed, USR1 is received, or something else changed between
+each iteration, repeating until TERM or INT is received.
 */
 
 /*
 Unix headers.
 */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <limits.h>
 #include <mntent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <linux/genetlink.h>
+#include <linux/if.h>
+#include <linux/io_uring.h>
+#include <linux/magic.h>
+#include <linux/netlink.h>
+#include <linux/nl80211.h>
+#include <linux/rtnetlink.h>
+
+#include "astatus.h"
 
 /*
 For optional libraries, I chose to use preprocessor macros to recreate
@@ -40,15 +70,34 @@ if different functions are needed.
 */
 
 #ifdef X
-#include <X11/Xlib.h>
+#include <xcb/xcb.h>
 #else /* X */
-#define DefaultRootWindow(x) (-1)
-#define Display void
-#define Window int
-#define XCloseDisplay(x) ((void)(x), -1)
-#define XFlush(dpy) NULL
-#define XOpenDisplay(x) ((void)(x), NULL)
-#define XStoreName(x, y, z) ((void)(x), (void)(y), (void)(z), -1)
+typedef struct { int root; } xcb_screen_t;
+typedef struct { xcb_screen_t *data; int rem; } xcb_screen_iterator_t;
+typedef struct { int atom; } xcb_intern_atom_reply_t;
+typedef int xcb_intern_atom_cookie_t;
+#define XCB_ATOM_NONE 0
+#define XCB_ATOM_STRING 0
+#define XCB_ATOM_WM_NAME 0
+#define XCB_PROP_MODE_REPLACE 0
+#define xcb_atom_t int
+#define xcb_change_property(c, m, w, p, t, f, l, d) ((void)(w), (void)(l), \
+		(void)(d))
+#define xcb_connect(x, y) ((void)(y), NULL)
+#define xcb_connection_has_error(c) (1)
+#define xcb_connection_t void
+#define xcb_disconnect(c) (void)(c)
+#define xcb_flush(c) (-1)
+#define xcb_generic_event_t void
+#define xcb_get_file_descriptor(c) (-1)
+#define xcb_get_setup(c) NULL
+#define xcb_intern_atom(c, o, l, n) ((void)(n), 0)
+#define xcb_intern_atom_reply(c, k, e) ((void)(k), \
+		(xcb_intern_atom_reply_t *)NULL)
+#define xcb_poll_for_event(c) NULL
+#define xcb_screen_next(i) ((i)->rem = 0)
+#define xcb_setup_roots_iterator(s) ((xcb_screen_iterator_t){NULL, 0})
+#define xcb_window_t int
 #endif /* X */
 
 #ifdef ALSA
@@ -62,8 +111,12 @@ if different functions are needed.
 #define snd_mixer_elem_t void
 #define snd_mixer_find_selem(x, y) NULL
 #define snd_mixer_free(x) (void)(x)
+#define snd_mixer_handle_events(x) (-1)
 #define snd_mixer_load(x) (-1)
 #define snd_mixer_open(x, y) (-1)
+#define snd_mixer_poll_descriptors(x, y, z) ((void)(y), 0)
+#define snd_mixer_poll_descriptors_count(x) (0)
+#define snd_mixer_poll_descriptors_revents(x, y, z, w) ((void)(y), (void)(w), -1)
 #define snd_mixer_selem_get_playback_switch(x, y, z) (-1)
 #define snd_mixer_selem_get_playback_volume(x, y, z) (-1)
 #define snd_mixer_selem_get_playback_volume_range(x, y, z) (-1)
@@ -106,16 +159,89 @@ will be a constant, false condition so the option will never match).
 #define XALLOWED 0
 #endif /* X */
 
+/*
+And once more for the blocks that config.mk can leave out (e.g., with
+NOWIFI=1). Each USE_* is a constant condition, so the compiler drops the
+code that is only used under a false one, and ONLYIF leaves the block's
+function out of the blocks table (which makes the block inactive).
+*/
+
+#ifdef NOWIFI
+#define USE_WIFI 0
+#else
+#define USE_WIFI 1
+#endif
+#ifdef NONET
+#define USE_NET 0
+#else
+#define USE_NET 1
+#endif
+#ifdef NODISKS
+#define USE_DISKS 0
+#else
+#define USE_DISKS 1
+#endif
+/* io shows the disks that are mounted, which only disks keeps track of */
+#if defined(NOIO) || defined(NODISKS)
+#define USE_IO 0
+#else
+#define USE_IO 1
+#endif
+#ifdef NOPRESSURE
+#define USE_PRESSURE 0
+#else
+#define USE_PRESSURE 1
+#endif
+#ifdef NOBATTERIES
+#define USE_BATTERIES 0
+#else
+#define USE_BATTERIES 1
+#endif
+#ifdef NOURING
+#define USE_URING 0
+#else
+#define USE_URING 1
+#endif
+
+#define ONLYIF(use, fn) ((use) ? (fn) : NULL)
+
 /*
 Some constants and string literals.
 */
 
 /* Typing this gets repetitive. */
 #define BATTERY_PREFIX "/sys/class/power_supply/"
-/* Max length of an net interface name. XXX What should this actually be? */
-#define MAX_INTERFACE_LEN 512
+/* Max number of clients in daemon mode (see -d). */
+#define MAX_CLIENTS 64
+/* Max number of file descriptors the event loop can wait on. */
+#define MAX_WATCHES (32 + MAX_CLIENTS)
+/* Max number of file descriptors an ALSA mixer can have. */
+#define MAX_MIXER_FDS 8
 /* Limit to the number of disks to display. THis seems reasonable. */
 #define MAX_NUM_DISKS 5
+/* Limit to the number of files kept open between refreshes. */
+#define MAX_CACHED_FILES 128
+/* Longest path that can be kept open between refreshes. */
+#define MAX_CACHED_PATH 256
+/* Limit to the number of devices of each kind to keep track of. */
+#define MAX_DEVICES 64
+/* Max length of a device name (longer names are ignored). */
+#define MAX_DEVICE_NAME 128
+/* Limit to the number of network interfaces to display. */
+#define MAX_NUM_IFACES 3
+/* Limit to the number of devices whose counters are kept for rates. */
+#define MAX_SAMPLED 64
+/* Max number of counters kept per device for rates. */
+#define MAX_COUNTERS 4
+/* Max length of an urgent message. */
+#define MAX_URGENT 256
+/* Limit to the number of alerts that can be in effect at once. */
+#define MAX_ALERTS 32
+/* Max length of an alert's key (see checkalert). */
+#define MAX_ALERT_KEY 64
+/* Number of buckets in a latency histogram; bucket i counts calls that
+took less than 2^(i + 1) microseconds (the last one counts the rest). */
+#define PROFILE_BUCKETS 24
 
 /*
 Macros that control configuration.
@@ -132,11 +258,48 @@ Macros that control configuration.
 /* ...and suffixed with this. */
 #define URGENT_SUFFIX "!!!!"
 /* Timing and flashing: */
-#define INTERVAL 5000 /* ms between refreshes */
+#define INTERVAL 5000 /* ms between refreshes of most blocks */
 #define HOLD_TIME 1500 /* ms to display status when there is an urgent msg */
 #define URGENT_FLASH_ON 100 /* ms to flash urgent message "on" for */
 #define URGENT_FLASH_OFF 50 /* ms to flash urgent message "off" for */
 #define URGENT_FLASHES 20 /* how many times to flash the urgent message */
+#define REALERT_WARNING 0 /* ms after which to flash a warning that is still
+		in effect again (0 = never) */
+#define REALERT_CRITICAL 300000 /* ...and the same for critical alerts */
+#define KEEPALIVE 0 /* ms after which to repeat an unchanged line (0 = never) */
+#define BLOCK_DEADLINE 200 /* ms a block gets before its last text is shown */
+#define READAHEAD_DEADLINE 20 /* ms to wait for the files to be read ahead
+		before the blocks read the rest themselves */
+#define SATURATED 90 /* % of the time a disk is busy (or of a link's speed)
+		that is urgent */
+#define STALLED 10 /* % of the last 10 s that tasks were stalled on a
+		resource that is urgent */
+/* Alerts that are in effect are shown at the start of the line, each
+prefixed with this. */
+#define ALERT_MARKER "!"
+/* Blocks that take too long are shown with their last text, prefixed
+with this. */
+#define STALE_PREFIX "~"
+/* PSI trigger (see pressure): an urgent message is printed right away
+when tasks are stalled on a resource for 150 ms within any 1 s window... */
+#define PSI_TRIGGER "some 150000 1000000"
+/* ...or, without CAP_SYS_RESOURCE (which the kernel then requires for
+windows that aren't a multiple of 2 s), 300 ms within any 2 s. */
+#define PSI_TRIGGER_UNPRIVILEGED "some 300000 2000000"
+/* Number of threads that collect blocks. */
+#define NUM_WORKERS 4
+/* Receive buffer of the uevent socket, in bytes, so a burst of uevents
+(e.g., plugging in a dock) isn't dropped. The limit for unprivileged
+users (net.core.rmem_max) may make it smaller. */
+#define UEVENT_RCVBUF (4 * 1024 * 1024)
+/* ...and the same for the socket that link changes are pushed to (see
+wifi), which container hosts flood with their veth links. */
+#define LINKS_RCVBUF (1024 * 1024)
+/* Socket that the daemon listens on and clients connect to (see -d and
+-c), in $XDG_RUNTIME_DIR unless -S is given. */
+#define SOCKET_NAME "astatus.sock"
+/* File that USR2 writes the profile to (for -p), or NULL for stderr. */
+#define PROFILE_FILE NULL
 
 /*
 Global variables declarations.
@@ -144,16 +307,60 @@ Global variables declarations.
 
 /* Program name/path used for error messages. */
 static char *argv0 = "astatus";
+/* Directory that proc(5) and sysfs(5) files are read from (see -r). */
+static const char *root = "";
+/* Time the blocks and publishing when this is true (see -p). */
+static int profiling;
 /* Exit the main loop when this becomes true. */
 static int done;
+/* The event loop's epoll instance. */
+static int epollfd = -1;
+/* The refresh timer, which is armed for the next block that is due. */
+static int timerfd = -1;
 /* Print to WM_NAME instead of stdout when this is true. */
 static int x = 0;
-/* X display to use when x != 0. */
-static Display *dpy;
-/* A buffer to print the status to when x != 0. */
-static char xbuf[4096];
-/* Urgent messages are copied here. */
-static char urgentmsg[2048];
+/* Print to the clients on socketpath instead when this is true. */
+static int daemonmode;
+/* The daemon's socket (see -S). */
+static const char *socketpath;
+/* X connection to use when x != 0. */
+static xcb_connection_t *conn;
+/* The last line that was published and when, to avoid repeating it. */
+static long lastlen = -1;
+static struct timespec lastpublished;
+/* The block running on the calling thread, if any (see checkalert). */
+static pthread_key_t ownerkey;
+/* Set when an event handler wants the line to be refreshed. */
+static int needrefresh;
+/* Set when the blocks should be probed again (see probeblocks). */
+static int needprobe = 1;
+/* Guards the alerts and the blocks' state that the worker threads share
+with the main thread. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Netlink socket for kernel uevents, or -1 if it could not be opened. */
+static int ueventfd = -1;
+
+/*
+Function declarations, for the few functions that are needed before
+they can be defined.
+*/
+
+struct strbuf;
+static int alsa(struct strbuf *sb);
+static int batteries(struct strbuf *sb);
+static int disks(struct strbuf *sb);
+static int io(struct strbuf *sb);
+static int net(struct strbuf *sb);
+static int pressure(struct strbuf *sb);
+static void expire(int (*fn)(struct strbuf *));
+static void expireall(void);
+static void scandevices(void);
+static void flushx(void);
+static void ringupdate(unsigned int slot, int fd);
+static void ringreap(void);
+static void dumpprofile(const char *path);
+static void requestlinks(void);
+static int wifi(struct strbuf *sb);
 
 /*
 Some general purpose utilities.
@@ -179,696 +386,4234 @@ die(const char *fmt, ...)
 	exit(1);
 }
 
-/*
-Signal handling. The signal handling code was taken from
-https://git.suckless.org/slstatus/file/slstatus.c.html#l74. Slstatus
-passes SA_RESTART to sigaction for USR1, and I'm not sure why (it seems
-to work fine without it).
-*/
-
-/* All signals (that we care about) exit, besides USR1. */
-static void
-onsignal(int signum)
+/* Put root followed by path into buf, which has room for PATH_MAX bytes.
+Returns buf. */
+static char *
+rootpath(char *buf, const char *path)
 {
-	if (signum != SIGUSR1)
-		done = 1;
+	size_t len;
+
+	len = strlen(root);
+	if (len >= PATH_MAX)
+		len = PATH_MAX - 1;
+	memcpy(buf, root, len);
+	buf[len] = '\0';
+	strncat(buf, path, PATH_MAX - len - 1);
+	return buf;
 }
 
-/*
-Exiting variants of various functions (which die() if an error would be
-returned). Not having inline error checking cleans up code, and exiting
-on errors from these functions is common here.
-*/
+/* Parse the unsigned decimal integer at s (after any blanks) into
+*value. Returns a pointer past the digits, or NULL if there are none. */
+static const char *
+parseulong(const char *s, unsigned long *value)
+{
+	unsigned long n;
+
+	while (*s == ' ' || *s == '\t')
+		s++;
+	if (*s < '0' || *s > '9')
+		return NULL;
+	for (n = 0; *s >= '0' && *s <= '9'; s++)
+		n = n * 10 + (unsigned long)(*s - '0');
+	*value = n;
+	return s;
+}
 
-static FILE *
-efmemopen(void *buf, size_t size, const char *mode)
+/* Parse n integers from s into values. Returns a pointer past the last
+one, or NULL if there aren't n. */
+static const char *
+parseulongs(const char *s, unsigned long *values, unsigned int n)
 {
-	FILE *result;
+	unsigned int i;
 
-	result = fmemopen(buf, size, mode);
-	if (result == NULL)
-		die("fmemopen:");
-	return result;
+	for (i = 0; i < n && s != NULL; i++)
+		s = parseulong(s, &values[i]);
+	return s;
 }
 
-static Display *
-eXOpenDisplay(char *display_name)
+/* Find the line in buf that starts with key (e.g., "MemTotal:" in
+/proc/meminfo). Returns a pointer past the key, or NULL if there is no
+such line. */
+static const char *
+findfield(const char *buf, const char *key)
 {
-	Display *result;
+	const char *line;
+	size_t len;
 
-	result = XOpenDisplay(display_name);
-	if (result == NULL)
-		die("XOpenDisplay: Failed to open display");
-	return result;
+	len = strlen(key);
+	for (line = buf; line != NULL; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (strncmp(line, key, len) == 0)
+			return line + len;
+	}
+	return NULL;
 }
 
-static void
-eXStoreName(Display *dpy, Window w, char *window_name)
+/* Parse the integer after key in buf (see findfield) into *value.
+Returns 0, or -1 if there is no such line or it has no integer. */
+static int
+getfield(const char *buf, const char *key, unsigned long *value)
 {
-	int rc;
+	const char *s;
 
-	rc = XStoreName(dpy, w, window_name);
-	if (rc < 0)
-		die("XStoreName: Allocation failed");
+	s = findfield(buf, key);
+	return s == NULL || parseulong(s, value) == NULL ? -1 : 0;
 }
 
+/*
+Snapshot.
+
+Besides printing them, the blocks keep the raw values they collect in
+staged, and after each refresh the main loop copies it to the shared
+memory object that other programs read it from (see astatus.h). The
+blocks set their fields with snaplock held, and the main thread is the
+only one that writes the shared memory, so the sequence lock only has to
+keep the readers from seeing a half-written snapshot.
+*/
+
+static struct astatus_snapshot staged = {
+	.version = ASTATUS_SNAPSHOT_VERSION,
+	.volume = -1,
+};
+/* Set when staged has changed since it was last copied. */
+static int stageddirty;
+static pthread_mutex_t snaplock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copy the len bytes at name into a snapshot's name, truncating it if
+needed. */
 static void
-eXCloseDisplay(Display *dpy)
+snapname(char *dst, const char *name, size_t len)
 {
-	int rc;
+	if (len >= ASTATUS_NAME)
+		len = ASTATUS_NAME - 1;
+	memcpy(dst, name, len);
+	memset(dst + len, 0, ASTATUS_NAME - len);
+}
 
-	rc = XCloseDisplay(dpy);
-	if (rc < 0)
-		die("XCloseDisplay: Failed to close display");
+/* Clear what fn's block put in staged, once it has nothing to show
+anymore (e.g., the last battery was unplugged), so the snapshot doesn't
+keep its last values. */
+static void
+unstage(int (*fn)(struct strbuf *))
+{
+	pthread_mutex_lock(&snaplock);
+	if (fn == wifi) {
+		staged.nwifi = 0;
+	} else if (fn == disks) {
+		staged.ndisks = 0;
+	} else if (fn == batteries) {
+		staged.nbatteries = 0;
+	} else if (fn == alsa) {
+		staged.volume = -1;
+		staged.muted = 0;
+	}
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
 }
 
 /*
-Wireless network interfaces.
-
-XXX is there a simpler way to do wifi? this is kinda a mess.
-The goal is to display the signal strength for any connected interfaces
-(can there be more than one?) and any disconnected interfaces. As far
-as I can tell based on a hour or so of searching, it does not look
-like there is a singular, simple interface that provides all of this
-information. The solution I came up with is:
+Alerts.
 
-- Use glob on /sys/class/ieee80211 to get a list of wireless interfaces.
-- Use /proc/net/wireless to get the signal strength of connected interfaces.
-- Use /sys/class/net to get the states of remaining interfaces.
+Blocks check for urgent conditions with checkalert every time they are
+collected. Each condition has a key, which is also how it is marked in
+the line (e.g., "BAT0 low"), a severity, and two thresholds: an alert
+starts when the value reaches enter, and only ends when the value gets
+past exit, so a value that hovers around a threshold doesn't make the
+alert come and go. If enter > exit, high values are alarming; otherwise,
+low ones are. An alert also ends if the block that checks it is
+collected without checking it (e.g., the battery was unplugged).
 
-Here are the (potential) issues and questions with this:
+A new alert is flashed once (see Flashing urgent messages) and is then
+marked in the line for as long as it lasts. It is flashed again when
+its severity goes up, or after REALERT_WARNING or REALERT_CRITICAL ms
+if those aren't 0. Alerts that start together wait their turn, the most
+severe first.
 
-- This feels inefficient and complicated.
-- I don't know the actual possible values of operstate thus min. buffer size.
-- I don't know the maximum length of an interface name thus min. buffer size.
-- Does it make sense to there to be multiple (dis)connected  interfaces?
-- Is this the behavior that I want it to actually have?
+The alerts are guarded by lock.
 */
 
-/* Fills *globptr with the names of all wireless interfaces. Returns the
-same value as glob(3). */
-static int
-globieee80211(glob_t *globptr)
+enum { ALERT_WARNING, ALERT_CRITICAL };
+
+static struct alert {
+	char key[MAX_ALERT_KEY];
+	char msg[MAX_URGENT];
+	int severity;
+	const void *owner; /* the block that checks it, or NULL */
+	int checked; /* since owner was last collected */
+	int flashedseverity; /* when it was last flashed, or -1 */
+	struct timespec flashed; /* CLOCK_MONOTONIC */
+} alerts[MAX_ALERTS];
+static unsigned int nalerts;
+
+/* Returns the alert with key, or NULL if it isn't in effect. */
+static struct alert *
+findalert(const char *key)
 {
-	int rc;
 	unsigned int i;
-	char *lastslash;
 
-	/* get all wireless adapters */
-	rc = glob("/sys/class/ieee80211/*/device/net/*", 0, NULL, globptr);
-	if (rc != 0)
-		return rc;
-	/* extract their names */
-	for (i = 0; i < globptr->gl_pathc; i++) {
-		lastslash = strrchr(globptr->gl_pathv[i], '/');
-		strcpy(globptr->gl_pathv[i], lastslash + 1);
-		/* we could even realloc  the string to be smaller */
+	for (i = 0; i < nalerts; i++) {
+		if (strcmp(alerts[i].key, key) == 0)
+			return &alerts[i];
 	}
-	return 0;
+	return NULL;
 }
 
-/* Scan one line from /proc/net/wireless. Returns EOF when everything
-has been read. */
-static int
-readwirelessline(FILE *f, char name[MAX_INTERFACE_LEN], int *linkqualityptr)
+/* Returns a new alert with key (at the end, so alerts are kept in the
+order they started in), or NULL if there are too many. */
+static struct alert *
+addalert(const char *key)
 {
-	int rc;
-	int dummy;
+	struct alert *a;
 
-	/* XXX is this loop necessary? */
-	do {
-		rc = fscanf(f, "%" TOSTRING(MAX_INTERFACE_LEN) "[^: \t]: "
-				"%*d %d. %*d. %*d %*d %*d %*d %*d %*d %d",
-				name, linkqualityptr, &dummy);
-	} while (rc != EOF && rc != 3);
-	return rc;
+	if (nalerts == MAX_ALERTS || strlen(key) >= MAX_ALERT_KEY)
+		return NULL;
+	a = &alerts[nalerts++];
+	memset(a, 0, sizeof(*a));
+	strcpy(a->key, key);
+	a->flashedseverity = -1;
+	return a;
 }
 
-/* Look for needle in *globptr. If found, free it and remove it from
-the list. Returns 1 if it was found, and 0 if it wasn't. */
-static int
-deletefromglob(const char *needle, glob_t *globptr)
+/* End an alert. */
+static void
+delalert(struct alert *a)
 {
-	unsigned int i;
+	memmove(a, a + 1, (alerts + --nalerts - a) * sizeof(*a));
+}
 
-	for (i = 0; i < globptr->gl_pathc; i++) {
-		if (strcmp(globptr->gl_pathv[i], needle) != 0)
-			continue;
-		free(globptr->gl_pathv[i]);
-		globptr->gl_pathv[i] = globptr->gl_pathv[--globptr->gl_pathc];
-		return 1;
+/* Start, update, or end the alert with key depending on value (see
+above), and set its message if it is in effect. */
+static void
+checkalert(const char *key, int severity, long value, long enter,
+		long exit, const char *fmt, ...)
+{
+	int on;
+	long threshold;
+	va_list ap;
+	struct alert *a;
+
+	pthread_mutex_lock(&lock);
+	a = findalert(key);
+	threshold = a == NULL ? enter : exit;
+	on = enter > exit ? value >= threshold : value <= threshold;
+	if (!on && a != NULL)
+		delalert(a);
+	if (!on || (a == NULL && (a = addalert(key)) == NULL)) {
+		pthread_mutex_unlock(&lock);
+		return;
 	}
-	return 0;
+	a->severity = severity;
+	a->owner = pthread_getspecific(ownerkey);
+	a->checked = 1;
+	va_start(ap, fmt);
+	vsnprintf(a->msg, sizeof(a->msg), fmt, ap);
+	va_end(ap);
+	pthread_mutex_unlock(&lock);
 }
 
-/* Reads /proc/net/wireless, prints info it finds, and deletes found
-interfaces from *globptr. Returns bytes written, or -1 if something went
-wrong. */
-static int
-readwireless(FILE *stream, glob_t *globptr)
+/* End the alerts owner didn't check since the last sweep. The lock must
+be held. */
+static void
+sweepalerts(const void *owner)
 {
-	int rc, total;
-	int linkquality;
-	FILE *wireless;
-	static char name[MAX_INTERFACE_LEN];
+	unsigned int i;
 
-	wireless = fopen("/proc/net/wireless", "r");
-	if (wireless == NULL)
-		return -1;
-	/* ignore the first two lines */
-	rc = fscanf(wireless, "%*[^\n]\n%*[^\n]\n");
-	if (rc != 0) {
-		fclose(wireless);
-		return -1;
-	}
-	/* read the remaining lines */
-	total = 0;
-	while (readwirelessline(wireless, name, &linkquality) != EOF) {
-		/* remove it from *globptr */
-		deletefromglob(name, globptr);
-		/* maybe print a seperator */
-		if (total > 0)
-			total += fprintf(stream, SEPARATOR);
-		/* print its information */
-		total += fprintf(stream, "%s %d", name, 100 * linkquality / 70);
+	for (i = 0; i < nalerts;) {
+		if (alerts[i].owner != owner) {
+			i++;
+		} else if (!alerts[i].checked) {
+			delalert(&alerts[i]);
+		} else {
+			alerts[i++].checked = 0;
+		}
 	}
-	/* done with that file */
-	fclose(wireless);
-	return total;
 }
 
-/* Prints the remaining interfaces in *globptr. Returns the number of
-bytes written */
-static int
-printdisconnected(FILE *stream, glob_t *globptr, int needsep)
+/* Remove all of owner's alerts, e.g., when its block
+becomes inactive. Must be called with lock held. */
+static void
+dropalerts(const void *owner)
 {
-	int rc, total;
 	unsigned int i;
-	FILE *file;
-	char operstate[16 /* I don't know the actual values of this */];
-	static char path[PATH_MAX];
 
-	total = 0;
-	for (i = 0; i < globptr->gl_pathc; i++) {
-		snprintf(path, PATH_MAX, "/sys/class/net/%s/operstate",
-				globptr->gl_pathv[i]);
-		file = fopen(path, "r");
-		if (file == NULL)
-			continue;
-		rc = fscanf(file, "%s", operstate);
-		fclose(file);
-		if (rc != 1)
-			continue;
-		if (needsep)
-			total += fprintf(stream, SEPARATOR);
-		total += fprintf(stream, "%s %s", globptr->gl_pathv[i],
-				operstate);
-		needsep = 1;
+	for (i = 0; i < nalerts;) {
+		if (alerts[i].owner == owner)
+			delalert(&alerts[i]);
+		else
+			i++;
 	}
-	return total;
 }
 
+/* Returns 1 if an alert should be flashed at *now, and 0 otherwise. */
 static int
-wifi(FILE *stream)
+alertdue(const struct alert *a, const struct timespec *now)
 {
-	int rc, total;
-	glob_t globbuf;
+	long realert, ms;
 
-	/* get all wireless interface names */
-	rc = globieee80211(&globbuf);
-	if (rc != 0)
-		return 0;
-	/* open the file that gives signal strengths */
-	rc = readwireless(stream, &globbuf);
-	if (rc == -1) {
-		globfree(&globbuf);
-		return 0;
-	}
-	total = rc;
-	/* print information about disconnected interfaces */
-	total += printdisconnected(stream, &globbuf, total != 0);
-	/* done */
-	globfree(&globbuf);
-	return total;
+	if (a->severity > a->flashedseverity)
+		return 1;
+	realert = a->severity == ALERT_CRITICAL ? REALERT_CRITICAL
+			: REALERT_WARNING;
+	ms = (now->tv_sec - a->flashed.tv_sec) * 1000
+			+ (now->tv_nsec - a->flashed.tv_nsec) / 1000000;
+	return realert > 0 && ms >= realert;
 }
 
 /*
-Disks.
-
-The goal is to print out the utilization and available space for mount
-points that correspond to partitions on hardware devices (I call these
-"disks" even though they are just partitions...). It should also ignore
-some partitions that (probably) don't matter, like /boot.
-
-One of the challenges with this is that some partitions are mounted more
-than once, like btrfs subvolumes. The solution I went with was to store
-all of the disks that have been printed so far in an array, and ignore
-any members of that array.
+Exiting variants of various functions (which die() if an error would be
+returned). Not having inline error checking cleans up code, and exiting
+on errors from these functions is common here.
+*/
 
-So, overall:
+static void *
+erealloc(void *ptr, size_t size)
+{
+	void *result;
 
-- Use /proc/mounts to find all mounted disks.
-- Ignore undesired disks (see shouldignoredisk).
-- Make sure the disk is not in the array.
-- Make sure the array is not full.
-- Print the disk's info.
-- Add it to the set.
+	result = realloc(ptr, size);
+	if (result == NULL)
+		die("realloc:");
+	return result;
+}
 
-An urgent message is printed if the disk is almost full.
+/*
+String builders.
 
-I read some busybox source before writing this section:
-https://git.busybox.net/busybox/tree/util-linux/mount.c#n2320 and
-https://git.busybox.net/busybox/tree/coreutils/df.c#n211.
+The blocks' text and the status line are built in string builders that
+are kept between refreshes. A builder only grows, so once it is large
+enough for its longest text, building doesn't allocate anymore (and
+text is never truncated). The few things blocks print (names, integers
+and single characters) are appended directly, without stdio.
 */
 
-/* Predicate that matches disks from /dev that aren't under boot. */
-static int
-shouldignoredisk(const struct mntent *entptr)
-{
-	int devlen, bootlen;
-
-	/* no magic numbers */
-	devlen = strlen("/dev");
-	bootlen = strlen("/boot");
-	/* ignore file systems that aren't from /dev */
-	if (strncmp(entptr->mnt_fsname, "/dev", devlen) != 0)
-		return 1;
-	/* ignore anything mounted below /boot */
-	if (strncmp(entptr->mnt_dir, "/boot", bootlen) == 0)
-		return 1;
-	/* everything else is fine */
-	return 0;
-}
+struct strbuf {
+	char *s; /* always NUL-terminated after sbreset */
+	size_t len, size;
+};
 
-/* Linear search on an array of string pointers. Returns the string if
-found, or NULL otherwise. */
-static char *
-strlsearch(const char *needle, char **haystack, int nstrings)
+/* Make room for n more bytes (and the NUL). */
+static void
+sbreserve(struct strbuf *sb, size_t n)
 {
-	int i;
+	size_t size;
 
-	for (i = 0; i < nstrings; i++) {
-		if (strcmp(needle, haystack[i]) == 0)
-			return haystack[i];
-	}
-	return NULL;
+	if (sb->len + n < sb->size)
+		return;
+	for (size = sb->size > 0 ? sb->size : 64; sb->len + n >= size;
+			size *= 2);
+	sb->s = erealloc(sb->s, size);
+	sb->size = size;
 }
 
-/* printf("%d%c", *baseptr, *suffixptr) will be a human-readable
-representation of bytes (parameter) bytes in binary units. */
+/* Empty sb. */
 static void
-frombytes(unsigned long int bytes, int *baseptr, char *suffixptr)
+sbreset(struct strbuf *sb)
 {
-	unsigned int i;
-	static const char suffixes[] = {'B', 'k', 'M', 'G', 'T', 'P', 'E'};
+	sbreserve(sb, 0);
+	sb->len = 0;
+	sb->s[0] = '\0';
+}
 
-	for (i = 0; i < LEN(suffixes) && bytes > 1024; i++, bytes /= 1024);
-	*baseptr = (int)bytes;
-	*suffixptr = i < LEN(suffixes) ? suffixes[i] : '?';
+/* Append n bytes from s. Returns n. */
+static int
+sbputmem(struct strbuf *sb, const char *s, size_t n)
+{
+	sbreserve(sb, n);
+	memcpy(sb->s + sb->len, s, n);
+	sb->len += n;
+	sb->s[sb->len] = '\0';
+	return (int)n;
 }
 
-/* Get the disk's info from statvfs and print it. */
 static int
-printadisk(FILE *stream, struct mntent *ent)
+sbputs(struct strbuf *sb, const char *s)
 {
-	int rc, pct;
-	unsigned long int total, avail, used;
-	int availbase;
-	char availsuffix;
-	char *lastslash, *name, *ptr;
-	struct statvfs statbuf;
-	static char path[PATH_MAX];
+	return sbputmem(sb, s, strlen(s));
+}
 
-	rc = statvfs(ent->mnt_dir, &statbuf);
-	if (rc < 0)
-		return 0;
-	/* compute the stats we want to show */
-	/* XXX will frsize ever != bsize? */
-	total = statbuf.f_frsize * statbuf.f_blocks;
-	avail = statbuf.f_frsize * statbuf.f_bavail;
-	used = total - avail;
-	pct = (int)(100ul * used / total);
-	frombytes(avail, &availbase, &availsuffix);
-	/* get the basename of the actual path */
-	ptr = realpath(ent->mnt_fsname, path);
-	if (ptr == NULL)
-		return 0;
-	lastslash = strrchr(path, '/');
-	name = lastslash == NULL ? path : lastslash + 1;
-	/* print its info */
-	if (pct > 90)
-		snprintf(urgentmsg, sizeof(urgentmsg), "%.128s is %d%% full "
-				" (%d%c left)", name, pct, availbase,
-				availsuffix);
-	return fprintf(stream, "%s %d%% %d%c", name,
-			pct, availbase, availsuffix);
+static int
+sbputc(struct strbuf *sb, char c)
+{
+	return sbputmem(sb, &c, 1);
 }
 
+/* Append n in decimal. */
 static int
-disks(FILE *stream)
+sbputint(struct strbuf *sb, long n)
 {
-	int ndisks, i, total;
-	struct mntent *entptr;
-	FILE *mounts;
-	char *results[MAX_NUM_DISKS];
+	char digits[24], *p;
+	unsigned long u;
 
-	total = ndisks = 0;
-	/* busybox also uses /etc/mtab; is that the same? */
-	mounts = setmntent("/proc/mounts", "r");
-	if (mounts == NULL) {
-		return 0;
-	}
-	/* busybox uses the gnu extension _r version */
-	while (entptr = getmntent(mounts), entptr != NULL) {
-		if (shouldignoredisk(entptr))
-			continue;
-		if (ndisks == MAX_NUM_DISKS)
-			break;
-		if (strlsearch(entptr->mnt_fsname, results, ndisks) != NULL)
-			continue;
-		results[ndisks++] = strdup(entptr->mnt_fsname);
-		if (total > 0)
-			total += fprintf(stream, SEPARATOR);
-		total += printadisk(stream, entptr);
-	}
-	endmntent(mounts);
-	for (i = 0; i < ndisks; i++)
-		free(results[i]);
-	return total;
+	p = digits + sizeof(digits);
+	u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+	do
+		*--p = '0' + u % 10;
+	while ((u /= 10) != 0);
+	if (n < 0)
+		*--p = '-';
+	return sbputmem(sb, p, digits + sizeof(digits) - p);
 }
 
 /*
-Memory utilization.
+Profiling.
 
-/proc/meminfo has all of the required info.
+With -p, every block call and every publish is timed, and the times are
+counted in log-scale histograms. The files each block opens and the
+bytes it reads are counted too. Blocks run on the worker threads, so
+readfile finds the profile to count in through profkey. Profiles are
+guarded by lock.
 */
 
-static int
-mem(FILE *stream)
-{
-	int rc;
-	FILE *meminfo;
-	long unsigned int pct, total, free, available;
+struct profile {
+	unsigned long calls;
+	unsigned long hist[PROFILE_BUCKETS];
+	unsigned long long totalus, maxus;
+	unsigned long opens;
+	unsigned long long bytes;
+};
 
-	meminfo = fopen("/proc/meminfo", "r");
-	if (meminfo == NULL)
-		return 0;
-	rc = fscanf(meminfo, "MemTotal: %lu kB "
-			"MemFree: %lu kB "
-			"MemAvailable: %lu kB ",
-			&total, &free, &available);
-	fclose(meminfo);
-	if (rc != 3)
-		return 0;
-	pct = 100lu * (total - available) / total;
-	return fprintf(stream, "mem %lu%%", pct);
-}
+/* The profile of the block running on the calling thread. */
+static pthread_key_t profkey;
+/* The profile of publish. */
+static struct profile publishprof;
 
-/*
-System load.
+/* Returns the microseconds since *start. */
+static unsigned long long
+sinceus(const struct timespec *start)
+{
+	struct timespec now;
 
-/proc/loadavg has all of the required info.
-*/
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000ll
+			+ (now.tv_nsec - start->tv_nsec) / 1000;
+}
 
-static int
-load(FILE *stream)
+/* Add a call that took us microseconds to *prof. */
+static void
+profileus(struct profile *prof, unsigned long long us)
 {
-	int rc;
-	float load;
-	FILE *loadavg;
+	unsigned int i;
 
-	loadavg = fopen("/proc/loadavg", "r");
-	if (loadavg == NULL)
-		return 0;
-	rc = fscanf(loadavg, "%f", &load);
-	fclose(loadavg);
-	if (rc != 1)
-		return 0;
-	return fprintf(stream, "load %.2f", load);
+	for (i = 0; i < PROFILE_BUCKETS - 1 && us >> (i + 1) != 0; i++);
+	pthread_mutex_lock(&lock);
+	prof->calls++;
+	prof->hist[i]++;
+	prof->totalus += us;
+	if (us > prof->maxus)
+		prof->maxus = us;
+	pthread_mutex_unlock(&lock);
 }
 
-/*
-ALSA volume & mute status.
+/* Add the time since *start to *prof. */
+static void
+profile(struct profile *prof, const struct timespec *start)
+{
+	profileus(prof, sinceus(start));
+}
 
-This part requires calling the correct sequence of libasound
-functions. I got that sequence of functions from these patches:
-https://tools.suckless.org/slstatus/patches/alsa/slstatus-alsa-4bd78c9.patch
-and
-https://tools.suckless.org/slstatus/patches/alsa/slstatus-alsa-mute-1.0.diff.
+/* Count opens files opened and bytes bytes read by the calling thread's
+block, if there is one. */
+static void
+countread(unsigned long opens, long bytes)
+{
+	struct profile *prof;
 
-XXXX Not too sure on the correct cleanup operations.
-*/
+	if (!profiling || (prof = pthread_getspecific(profkey)) == NULL)
+		return;
+	pthread_mutex_lock(&lock);
+	prof->opens += opens;
+	if (bytes > 0)
+		prof->bytes += bytes;
+	pthread_mutex_unlock(&lock);
+}
 
-static int
-alsa(FILE *stream)
+/* Print a profile on one line, followed by its non-empty histogram
+buckets on the next. The lock must be held. */
+static void
+printprofile(FILE *stream, const char *name, const struct profile *prof)
 {
-	int rc, total;
-	long int min, max, vol;
-	int sw;
-	snd_mixer_t *mixer;
-	snd_mixer_selem_id_t *mixerid;
-	snd_mixer_elem_t *elem;
+	unsigned int i;
 
-	total = 0;
-	/* XXX how much error checking is necessary? */
-	rc = snd_mixer_open(&mixer, 0);
-	if (rc != 0)
-		return 0;
-	rc = snd_mixer_attach(mixer, ALSA_DEVICE);
-	if (rc != 0)
-		goto close;
-	rc = snd_mixer_selem_register(mixer, NULL, NULL);
-	if (rc != 0)
-		goto detach;
-	rc = snd_mixer_load(mixer);
-	if (rc != 0)
-		goto detach;
-	snd_mixer_selem_id_alloca(&mixerid);
-	snd_mixer_selem_id_set_name(mixerid, ALSA_MIXER);
-	snd_mixer_selem_id_set_index(mixerid, 0);
-	elem = snd_mixer_find_selem(mixer, mixerid);
-	if (elem == NULL)
-		goto free;
-	rc = snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-	if (rc != 0)
-		goto free;
-	rc = snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_MONO,
-			&vol);
-	if (rc != 0)
-		goto free;
-	rc = snd_mixer_selem_get_playback_switch(elem, 0, &sw);
-	if (rc != 0)
-		goto free;
-	max -= min;
-	vol -= min;
-	if (sw)
-		total = fprintf(stream, "vol %ld%%", 100l * vol / max);
-	else
-		total = fprintf(stream, "vol muted");
-free:	snd_mixer_free(mixer);
-detach:	snd_mixer_detach(mixer, ALSA_DEVICE);
-close:	snd_mixer_close(mixer);
-	return total;
+	fprintf(stream, "%-10s %8lu %10llu %10llu %8lu %12llu\n", name,
+			prof->calls,
+			prof->calls > 0 ? prof->totalus / prof->calls : 0,
+			prof->maxus, prof->opens, prof->bytes);
+	fprintf(stream, "          ");
+	for (i = 0; i < PROFILE_BUCKETS; i++) {
+		if (prof->hist[i] == 0)
+			continue;
+		if (i < PROFILE_BUCKETS - 1)
+			fprintf(stream, " <%luus:%lu", 2ul << i, prof->hist[i]);
+		else
+			fprintf(stream, " more:%lu", prof->hist[i]);
+	}
+	fputc('\n', stream);
 }
 
 /*
-Battery states and capacities.
+The event loop.
 
-/sys/class/power_supply contains all power-related devices. Batteries
-will have ./type read "Battery."
+Everything astatus waits for goes through one epoll(7) set: signals
+(read from a signalfd), the refresh timer (a timerfd), and any other
+source that registers a watch with addwatch, like the uevent socket or
+the ALSA mixer. A watch's handler returns 1 if the status line should be
+refreshed.
 
-When a battery is very low (≤ 5%), an urgent message is printed.
+Since signals are blocked and read from the signalfd, a USR1 that
+arrives while the status is being collected isn't lost; it just ends the
+next wait right away. The timer is armed with absolute deadlines, so
+refreshes don't drift by however long collecting the status took.
 */
 
-/* Convert the first letter of ./status to a symbol to print. */
-static char
-batterychar(char ch)
+static struct watch {
+	int fd;
+	int (*handler)(int fd, unsigned int events);
+} watches[MAX_WATCHES];
+
+/* Wait for events on fd and call handler when they happen. Returns 0
+on success, and -1 if fd can't be waited on. */
+static int
+addwatch(int fd, unsigned int events, int (*handler)(int, unsigned int))
+{
+	unsigned int i;
+	struct epoll_event ev = {
+		.events = events,
+	};
+
+	for (i = 0; i < MAX_WATCHES && watches[i].handler != NULL; i++);
+	if (i == MAX_WATCHES)
+		die("addwatch: Too many watches");
+	ev.data.ptr = &watches[i];
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -1;
+	watches[i].fd = fd;
+	watches[i].handler = handler;
+	return 0;
+}
+
+/* Exiting variant of addwatch. */
+static void
+eaddwatch(int fd, unsigned int events, int (*handler)(int, unsigned int))
+{
+	if (addwatch(fd, events, handler) < 0)
+		die("epoll_ctl:");
+}
+
+/* Change the events that fd is waited on for. */
+static void
+modwatch(int fd, unsigned int events)
+{
+	unsigned int i;
+	struct epoll_event ev = {
+		.events = events,
+	};
+
+	for (i = 0; i < MAX_WATCHES; i++) {
+		if (watches[i].handler == NULL || watches[i].fd != fd)
+			continue;
+		ev.data.ptr = &watches[i];
+		if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+			die("epoll_ctl:");
+		return;
+	}
+}
+
+/* Stop waiting for events on fd. */
+static void
+delwatch(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_WATCHES; i++) {
+		if (watches[i].handler == NULL || watches[i].fd != fd)
+			continue;
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+		watches[i].handler = NULL;
+		return;
+	}
+}
+
+/* All signals (that we care about) exit, besides USR1 and USR2 (which
+is only caught for -p). */
+static int
+onsignal(int fd, unsigned int events)
+{
+	int refresh;
+	struct signalfd_siginfo info;
+
+	(void)events;
+	refresh = 0;
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGUSR2) {
+			dumpprofile(PROFILE_FILE);
+			continue;
+		}
+		if (info.ssi_signo == SIGHUP) {
+			scandevices();
+			needprobe = 1;
+		}
+		if (info.ssi_signo == SIGHUP || info.ssi_signo == SIGUSR1)
+			expireall();
+		else
+			done = 1;
+		refresh = 1;
+	}
+	return refresh;
+}
+
+static int
+ontimer(int fd, unsigned int events)
+{
+	uint64_t expirations;
+
+	(void)events;
+	return read(fd, &expirations, sizeof(expirations)) > 0;
+}
+
+/* Create the epoll instance, the signalfd and the refresh timer. */
+static void
+setupevents(void)
+{
+	int fd;
+	sigset_t mask;
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd < 0)
+		die("epoll_create1:");
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGHUP);
+	if (profiling)
+		sigaddset(&mask, SIGUSR2);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+		die("sigprocmask:");
+	fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+		die("signalfd:");
+	eaddwatch(fd, EPOLLIN, onsignal);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0)
+		die("timerfd_create:");
+	eaddwatch(timerfd, EPOLLIN, ontimer);
+}
+
+/* Arm the refresh timer for the absolute CLOCK_MONOTONIC time *when. */
+static void
+armtimer(const struct timespec *when)
+{
+	struct itimerspec its = {
+		.it_value = *when,
+	};
+
+	/* a zero it_value would disarm it instead */
+	if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+		its.it_value.tv_nsec = 1;
+	if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		die("timerfd_settime:");
+}
+
+/* Wait up to timeout ms (or forever if it is negative) for events and
+handle them. Sets needrefresh if a handler asked for it. */
+static void
+waitevents(int timeout)
+{
+	int i, n;
+	struct watch *w;
+	struct epoll_event evs[MAX_WATCHES];
+
+	/* send what was published since the last wait in one go */
+	flushx();
+	n = epoll_wait(epollfd, evs, MAX_WATCHES, timeout);
+	if (n < 0 && errno == EINTR)
+		return;
+	if (n < 0)
+		die("epoll_wait:");
+	for (i = 0; i < n; i++) {
+		w = evs[i].data.ptr;
+		/* an earlier handler may have removed it */
+		if (w->handler == NULL)
+			continue;
+		needrefresh |= w->handler(w->fd, evs[i].events);
+	}
+}
+
+/*
+File handle cache.
+
+Most of the status information comes from small files in /proc and /sys
+that are read every refresh. Instead of opening and closing them each
+time, keep them open and re-read them from the beginning with pread(2).
+If a read fails (e.g., the device behind a sysfs file went away), the
+file is reopened once; if that fails too, it is dropped from the cache.
+
+The worker threads share the cache, so it is locked while a file is
+being read (otherwise a file could be evicted while it is being read).
+*/
+
+static struct cachedfile {
+	char path[MAX_CACHED_PATH];
+	int fd;
+	/* for the ring (see ringread) */
+	const void *owner; /* block that read it last */
+	size_t want; /* size of the largest buffer it was read into */
+	char *data; /* what the ring read ahead, for the next readfile */
+	size_t cap; /* size of data */
+	ssize_t len; /* bytes in data */
+	unsigned long fetched; /* ring.batches when data was read */
+	unsigned long pending; /* ring.batches of the read into data that is
+			still in flight, or 0 */
+} filecache[MAX_CACHED_FILES];
+/* Number of entries used in filecache. */
+static unsigned int ncachedfiles;
+/* Next entry to evict when filecache is full. */
+static unsigned int nextevict;
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+/* The io_uring that reads the cached files ahead (see ringread), with
+its entries in filecache's slots. */
+static struct {
+	int fd;
+	unsigned int *sqtail, *sqmask, *sqarray;
+	unsigned int *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned long batches, enters;
+	unsigned int inflight; /* reads submitted but not reaped */
+	/* buffers of entries that were closed or reused while a read into
+	them was in flight, freed once it is reaped */
+	char *orphans[MAX_CACHED_FILES];
+	unsigned int norphans;
+} ring = { .fd = -1 };
+
+/* Let go of an entry's read-ahead buffer if a read into it is still in
+flight, since it can't be freed or handed to another file until the read
+is reaped. The cache must be locked. */
+static void
+orphan(struct cachedfile *cf)
+{
+	if (cf->pending == 0)
+		return;
+	ring.orphans[ring.norphans++] = cf->data;
+	cf->data = NULL;
+	cf->cap = 0;
+	cf->pending = 0;
+}
+
+/* Open path and store it in the cache. Returns the entry, or NULL if
+the file could not be opened. */
+static struct cachedfile *
+cacheopen(const char *path)
+{
+	int fd;
+	struct cachedfile *cf;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	countread(1, 0);
+	if (fd < 0)
+		return NULL;
+	if (ncachedfiles < MAX_CACHED_FILES) {
+		cf = &filecache[ncachedfiles++];
+	} else {
+		cf = &filecache[nextevict];
+		nextevict = (nextevict + 1) % MAX_CACHED_FILES;
+		close(cf->fd);
+		orphan(cf);
+	}
+	strcpy(cf->path, path);
+	cf->fd = fd;
+	/* the read-ahead buffer is kept for the next file in the entry */
+	cf->owner = NULL;
+	cf->want = 0;
+	cf->fetched = 0;
+	ringupdate((unsigned int)(cf - filecache), fd);
+	return cf;
+}
+
+/* Close an entry and remove it from the cache. */
+static void
+cacheclose(struct cachedfile *cf)
+{
+	unsigned int slot;
+
+	close(cf->fd);
+	orphan(cf);
+	free(cf->data);
+	slot = (unsigned int)(cf - filecache);
+	*cf = filecache[--ncachedfiles];
+	filecache[ncachedfiles].data = NULL;
+	filecache[ncachedfiles].cap = 0;
+	if (slot < ncachedfiles)
+		ringupdate(slot, cf->fd);
+	ringupdate(ncachedfiles, -1);
+}
+
+/* Read up to size - 1 bytes from the beginning of path into buf and
+NUL-terminate it. Returns the number of bytes read, or -1 on error. The
+cache must be locked. */
+static ssize_t
+readfilelocked(const char *path, char *buf, size_t size)
+{
+	int fd;
+	unsigned int i;
+	ssize_t n;
+	struct cachedfile *cf;
+
+	/* paths too long to remember are read the old-fashioned way */
+	if (strlen(path) >= MAX_CACHED_PATH) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		countread(1, 0);
+		if (fd < 0)
+			return -1;
+		n = read(fd, buf, size - 1);
+		close(fd);
+		countread(0, n);
+		if (n < 0)
+			return -1;
+		buf[n] = '\0';
+		return n;
+	}
+	for (i = 0, cf = NULL; i < ncachedfiles; i++) {
+		if (strcmp(filecache[i].path, path) == 0) {
+			cf = &filecache[i];
+			break;
+		}
+	}
+	if (cf == NULL && (cf = cacheopen(path)) == NULL)
+		return -1;
+	cf->owner = pthread_getspecific(ownerkey);
+	if (size > cf->want)
+		cf->want = size;
+	/* use what the ring read ahead for this batch, once, if it is done
+	(and read it here otherwise) */
+	ringreap();
+	if (cf->fetched != 0 && cf->fetched == ring.batches
+			&& cf->cap >= size) {
+		cf->fetched = 0;
+		n = cf->len < (ssize_t)size - 1 ? cf->len : (ssize_t)size - 1;
+		memcpy(buf, cf->data, (size_t)n);
+		buf[n] = '\0';
+		countread(0, n);
+		return n;
+	}
+	n = pread(cf->fd, buf, size - 1, 0);
+	countread(0, n);
+	if (n < 0) {
+		/* the file may have been replaced, so try once more */
+		cacheclose(cf);
+		cf = cacheopen(path);
+		if (cf == NULL)
+			return -1;
+		n = pread(cf->fd, buf, size - 1, 0);
+		countread(0, n);
+		if (n < 0) {
+			cacheclose(cf);
+			return -1;
+		}
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+/* Same as readfilelocked, but it locks the cache itself and prefixes
+path with root. */
+static ssize_t
+readfile(const char *path, char *buf, size_t size)
+{
+	ssize_t n;
+	char full[PATH_MAX];
+
+	rootpath(full, path);
+	pthread_mutex_lock(&cachelock);
+	n = readfilelocked(full, buf, size);
+	pthread_mutex_unlock(&cachelock);
+	return n;
+}
+
+/*
+Read-ahead ring.
+
+Even with the files kept open, a refresh still reads them one pread(2)
+at a time, spread over the blocks. Where io_uring is available, the
+cached files are registered with a ring (in the same slots as in
+filecache), and, before the blocks that are due are collected, the files
+they read last time are all read ahead with one io_uring_enter(2).
+readfile then hands a block what was read ahead instead of reading the
+file again (once, and only if it is from the latest batch, so a block
+never gets old data). Files that weren't read ahead are read with pread
+as before, and so is everything if the ring can't be set up (e.g., on
+kernels before 5.11, or where io_uring is disabled).
+
+sysfs files can't be read without blocking, so the kernel reads them on
+its own threads, and one of them can hang (e.g., a battery whose
+controller doesn't answer). The main thread only waits READAHEAD_DEADLINE
+ms for the batch, without the cache locked; reads that aren't done by
+then are reaped whenever they are, and until then, the blocks read those
+files with pread on their worker threads as if they hadn't been read
+ahead. A buffer that a read is still in flight into is never freed or
+reused for another file.
+
+There is no liburing here, just the three system calls.
+*/
+
+static void
+closering(void)
+{
+	close(ring.fd);
+	ring.fd = -1;
+}
+
+/* Set up the ring and register the cached files with it. Failing is not
+fatal. */
+static void
+openring(void)
+{
+	int fd, fds[MAX_CACHED_FILES], supported;
+	unsigned int i;
+	size_t len;
+	char *sq, *sqes;
+	struct io_uring_params params;
+	struct io_uring_probe *probe;
+
+	memset(&params, 0, sizeof(params));
+	fd = (int)syscall(__NR_io_uring_setup, MAX_CACHED_FILES, &params);
+	if (fd < 0)
+		return;
+	ring.fd = fd;
+	/* IORING_OP_READ is from 5.6 */
+	len = sizeof(*probe) + (IORING_OP_READ + 1) * sizeof(probe->ops[0]);
+	probe = memset(erealloc(NULL, len), 0, len);
+	supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+			probe, IORING_OP_READ + 1) == 0
+			&& probe->last_op >= IORING_OP_READ
+			&& probe->ops[IORING_OP_READ].flags
+			& IO_URING_OP_SUPPORTED;
+	free(probe);
+	/* IORING_FEAT_EXT_ARG (for the wait's timeout) is from 5.11 */
+	if (!supported || !(params.features & IORING_FEAT_SINGLE_MMAP)
+			|| !(params.features & IORING_FEAT_EXT_ARG)) {
+		closering();
+		return;
+	}
+	len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	if (len < params.cq_off.cqes + params.cq_entries
+			* sizeof(struct io_uring_cqe))
+		len = params.cq_off.cqes + params.cq_entries
+				* sizeof(struct io_uring_cqe);
+	sq = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			IORING_OFF_SQ_RING);
+	sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			IORING_OFF_SQES);
+	if (sq == MAP_FAILED || sqes == MAP_FAILED) {
+		closering();
+		return;
+	}
+	ring.sqtail = (unsigned int *)(sq + params.sq_off.tail);
+	ring.sqmask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring.sqarray = (unsigned int *)(sq + params.sq_off.array);
+	ring.cqhead = (unsigned int *)(sq + params.cq_off.head);
+	ring.cqtail = (unsigned int *)(sq + params.cq_off.tail);
+	ring.cqmask = (unsigned int *)(sq + params.cq_off.ring_mask);
+	ring.sqes = (struct io_uring_sqe *)sqes;
+	ring.cqes = (struct io_uring_cqe *)(sq + params.cq_off.cqes);
+	pthread_mutex_lock(&cachelock);
+	for (i = 0; i < MAX_CACHED_FILES; i++)
+		fds[i] = i < ncachedfiles ? filecache[i].fd : -1;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, fds,
+			MAX_CACHED_FILES) < 0)
+		closering();
+	pthread_mutex_unlock(&cachelock);
+}
+
+/* Register fd in slot (or -1 to empty it). The cache must be locked. */
+static void
+ringupdate(unsigned int slot, int fd)
+{
+	struct io_uring_files_update update;
+
+	if (ring.fd < 0)
+		return;
+	memset(&update, 0, sizeof(update));
+	update.offset = slot;
+	update.fds = (uint64_t)(uintptr_t)&fd;
+	/* without the file in its slot, reading ahead would go wrong */
+	if (syscall(__NR_io_uring_register, ring.fd,
+			IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+		closering();
+}
+
+/* Take in the reads that completed since the last call, without
+waiting for any. The cache must be locked. */
+static void
+ringreap(void)
+{
+	unsigned int i, head, mask;
+	char *data;
+	struct io_uring_cqe *cqe;
+
+	if (ring.fd < 0 || ring.inflight == 0)
+		return;
+	head = *ring.cqhead;
+	mask = *ring.cqmask;
+	while (head != __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)) {
+		cqe = &ring.cqes[head & mask];
+		data = (char *)(uintptr_t)cqe->user_data;
+		ring.inflight--;
+		head++;
+		/* entries move around in filecache, but keep their buffer */
+		for (i = 0; i < ncachedfiles && (filecache[i].data != data
+				|| filecache[i].pending == 0); i++);
+		if (i < ncachedfiles) {
+			if (cqe->res >= 0) {
+				filecache[i].len = cqe->res;
+				filecache[i].fetched = filecache[i].pending;
+			}
+			filecache[i].pending = 0;
+			continue;
+		}
+		for (i = 0; i < ring.norphans && ring.orphans[i] != data; i++);
+		if (i < ring.norphans) {
+			free(data);
+			ring.orphans[i] = ring.orphans[--ring.norphans];
+		}
+	}
+	__atomic_store_n(ring.cqhead, head, __ATOMIC_RELEASE);
+}
+
+/* Read ahead the cached files whose owners (the blocks that read them
+last) wanted says are about to be collected, and wait up to
+READAHEAD_DEADLINE ms for them. */
+static void
+ringread(int (*wanted)(const void *owner))
+{
+	unsigned int i, n, tail, mask;
+	long rc;
+	struct cachedfile *cf;
+	struct io_uring_sqe *sqe;
+	struct __kernel_timespec ts = {
+		.tv_sec = READAHEAD_DEADLINE / 1000,
+		.tv_nsec = READAHEAD_DEADLINE % 1000 * 1000000l,
+	};
+	struct io_uring_getevents_arg arg = {
+		.ts = (uint64_t)(uintptr_t)&ts,
+	};
+
+	if (ring.fd < 0)
+		return;
+	pthread_mutex_lock(&cachelock);
+	ringreap();
+	ring.batches++;
+	tail = *ring.sqtail;
+	mask = *ring.sqmask;
+	/* at most MAX_CACHED_FILES reads are in flight, so neither the
+	submission nor the completion queue can overflow, and every buffer
+	that is orphaned has a place in ring.orphans */
+	for (i = 0, n = 0; i < ncachedfiles
+			&& ring.inflight < MAX_CACHED_FILES; i++) {
+		cf = &filecache[i];
+		/* a file whose last read still hangs isn't read again */
+		if (cf->owner == NULL || cf->want == 0 || cf->pending != 0
+				|| !wanted(cf->owner))
+			continue;
+		if (cf->cap < cf->want) {
+			cf->data = erealloc(cf->data, cf->want);
+			cf->cap = cf->want;
+		}
+		sqe = &ring.sqes[tail & mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = (int)i;
+		sqe->addr = (uint64_t)(uintptr_t)cf->data;
+		sqe->len = (uint32_t)(cf->cap - 1);
+		sqe->user_data = (uint64_t)(uintptr_t)cf->data;
+		ring.sqarray[tail & mask] = tail & mask;
+		cf->pending = ring.batches;
+		ring.inflight++;
+		tail++;
+		n++;
+	}
+	if (n == 0) {
+		pthread_mutex_unlock(&cachelock);
+		return;
+	}
+	__atomic_store_n(ring.sqtail, tail, __ATOMIC_RELEASE);
+	/* submit them and wait for them in one go, but not for long, and
+	without keeping the workers out of the cache */
+	pthread_mutex_unlock(&cachelock);
+	do {
+		rc = syscall(__NR_io_uring_enter, ring.fd, n, n,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+		ring.enters++;
+	} while (rc < 0 && errno == EINTR);
+	pthread_mutex_lock(&cachelock);
+	/* with nothing submitted, nothing will complete either */
+	if (rc < 0 && errno != ETIME)
+		closering();
+	else
+		ringreap();
+	pthread_mutex_unlock(&cachelock);
+}
+
+/*
+Device registry.
+
+Wireless interfaces and power supplies hardly ever come and go, so
+instead of globbing sysfs every refresh, they are listed once at startup
+and then kept up to date with the kernel's uevents (the same messages
+udev listens to). A uevent is a datagram of NUL-separated strings: a
+"ACTION@DEVPATH" header followed by KEY=VALUE pairs.
+
+If the uevent socket cannot be opened, the lists are rebuilt every
+refresh like before.
+
+The lists are changed by the main thread, so blocks (which may run on
+worker threads) copy the list they need with copydevices.
+
+Power supplies that turn out not to be batteries (e.g., AC adapters) are
+remembered in otherpsus, so they are only looked at once. A supply is
+forgotten there when it is added, removed or renamed.
+*/
+
+static struct devlist {
+	char names[MAX_DEVICES][MAX_DEVICE_NAME];
+	unsigned int n;
+} wirelessdevs, powersupplies, otherpsus;
+static pthread_mutex_t registrylock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns 1 if name is in *list, and 0 otherwise. */
+static int
+devfind(const struct devlist *list, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->n; i++) {
+		if (strcmp(list->names[i], name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Copy the names in *list that aren't in *exclude (if it isn't NULL)
+into *copy. */
+static void
+copydevices(struct devlist *copy, const struct devlist *list,
+		const struct devlist *exclude)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&registrylock);
+	for (i = 0, copy->n = 0; i < list->n; i++) {
+		if (exclude == NULL || !devfind(exclude, list->names[i]))
+			strcpy(copy->names[copy->n++], list->names[i]);
+	}
+	pthread_mutex_unlock(&registrylock);
+}
+
+/* Add name to *list if it isn't already there. */
+static void
+devadd(struct devlist *list, const char *name)
+{
+	if (list->n == MAX_DEVICES || strlen(name) >= MAX_DEVICE_NAME)
+		return;
+	if (!devfind(list, name))
+		strcpy(list->names[list->n++], name);
+}
+
+/* Remove name from *list if it is there. */
+static void
+devdel(struct devlist *list, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->n; i++) {
+		if (strcmp(list->names[i], name) != 0)
+			continue;
+		if (i != --list->n)
+			strcpy(list->names[i], list->names[list->n]);
+		return;
+	}
+}
+
+/* Replace the contents of *list with the basenames of the paths matching
+pattern (under root). */
+static void
+devglob(struct devlist *list, const char *pattern)
+{
+	unsigned int i;
+	glob_t globbuf;
+	char path[PATH_MAX];
+
+	list->n = 0;
+	if (glob(rootpath(path, pattern), 0, NULL, &globbuf) != 0)
+		return;
+	for (i = 0; i < globbuf.gl_pathc; i++)
+		devadd(list, strrchr(globbuf.gl_pathv[i], '/') + 1);
+	globfree(&globbuf);
+}
+
+/* Fill the registry from sysfs. */
+static void
+scandevices(void)
+{
+	pthread_mutex_lock(&registrylock);
+	devglob(&wirelessdevs, "/sys/class/ieee80211/*/device/net/*");
+	devglob(&powersupplies, BATTERY_PREFIX "*");
+	pthread_mutex_unlock(&registrylock);
+}
+
+/* Apply one uevent to the registry. Returns 1 if it changed anything
+(or a sound card came or went), and 0 otherwise. */
+static int
+applyuevent(char *msg, size_t len)
+{
+	char *p, *end, *slash;
+	char *action, *subsystem, *devpath, *devpathold, *devtype;
+	struct devlist *list;
+
+	action = subsystem = devpath = devpathold = devtype = NULL;
+	for (p = msg, end = msg + len; p < end; p += strlen(p) + 1) {
+		if (strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if (strncmp(p, "DEVPATH=", 8) == 0)
+			devpath = p + 8;
+		else if (strncmp(p, "DEVPATH_OLD=", 12) == 0)
+			devpathold = p + 12;
+		else if (strncmp(p, "DEVTYPE=", 8) == 0)
+			devtype = p + 8;
+	}
+	if (action == NULL || subsystem == NULL || devpath == NULL)
+		return 0;
+	/* sound cards aren't in the registry, but the mixer might have
+	come or gone with them (see probealsa) */
+	if (strcmp(subsystem, "sound") == 0)
+		return strcmp(action, "add") == 0
+				|| strcmp(action, "remove") == 0;
+	if (strcmp(subsystem, "power_supply") == 0)
+		list = &powersupplies;
+	else if (strcmp(subsystem, "net") == 0 && devtype != NULL
+			&& strcmp(devtype, "wlan") == 0)
+		list = &wirelessdevs;
+	else
+		return 0;
+	if (strcmp(action, "move") == 0 && devpathold != NULL) {
+		slash = strrchr(devpathold, '/');
+		devdel(list, slash == NULL ? devpathold : slash + 1);
+		devdel(&otherpsus, slash == NULL ? devpathold : slash + 1);
+	} else if (strcmp(action, "add") != 0 && strcmp(action, "remove") != 0) {
+		return 0;
+	}
+	slash = strrchr(devpath, '/');
+	if (list == &powersupplies)
+		devdel(&otherpsus, slash == NULL ? devpath : slash + 1);
+	if (strcmp(action, "remove") == 0)
+		devdel(list, slash == NULL ? devpath : slash + 1);
+	else
+		devadd(list, slash == NULL ? devpath : slash + 1);
+	return 1;
+}
+
+/* Make a netlink socket's receive buffer size bytes, as udev does: past
+rmem_max if privileged, and up to it otherwise. */
+static void
+growrcvbuf(int fd, int size)
+{
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+			sizeof(size)) < 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+/* Read all pending uevents. If the socket's buffer overflowed, the
+uevents that were dropped can't be known, so the registry is filled
+from sysfs again. Returns 1 if the registry changed (or may have), and 0
+otherwise. */
+static int
+readuevents(void)
+{
+	int changed;
+	ssize_t n;
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	static char msg[8192];
+
+	changed = 0;
+	for (;;) {
+		addrlen = sizeof(addr);
+		n = recvfrom(ueventfd, msg, sizeof(msg) - 1, 0,
+				(struct sockaddr *)&addr, &addrlen);
+		if (n < 0 && errno == ENOBUFS) {
+			scandevices();
+			changed = 1;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+		/* only trust the kernel */
+		if (addr.nl_pid != 0)
+			continue;
+		msg[n] = '\0';
+		pthread_mutex_lock(&registrylock);
+		changed |= applyuevent(msg, (size_t)n);
+		pthread_mutex_unlock(&registrylock);
+	}
+	return changed;
+}
+
+static int
+onuevent(int fd, unsigned int events)
+{
+	(void)fd;
+	(void)events;
+	/* uevents that don't concern us shouldn't refresh early */
+	if (!readuevents())
+		return 0;
+	/* a new wireless interface's state has to be looked up */
+	if (USE_WIFI) {
+		requestlinks();
+		expire(wifi);
+	}
+	if (USE_BATTERIES)
+		expire(batteries);
+	needprobe = 1;
+	return 1;
+}
+
+/* Open the uevent socket. Failing is not fatal. */
+static void
+openuevents(void)
+{
+	int fd;
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1, /* the kernel's group (udev rebroadcasts on 2) */
+	};
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return;
+	growrcvbuf(fd, UEVENT_RCVBUF);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return;
+	}
+	ueventfd = fd;
+	eaddwatch(fd, EPOLLIN, onuevent);
+}
+
+/*
+Wireless network interfaces.
+
+The goal is to display the signal strength for any connected interfaces
+(can there be more than one?) and the state of any disconnected
+interfaces. All of that is available from netlink:
+
+- The device registry has the names of the wireless interfaces.
+- An rtnetlink socket subscribed to RTMGRP_LINK has the kernel push
+interface up/down (operstate) changes to us, so they don't have to be
+polled. The current states are requested once at startup (and again
+when the registry changes).
+- For interfaces that are up, an nl80211 (generic netlink) station dump
+gives the access point's signal in dBm and the transmit bitrate.
+
+Here are the (potential) issues and questions with this:
+
+- Does it make sense to there to be multiple (dis)connected  interfaces?
+- Is this the behavior that I want it to actually have?
+
+The netlink parts are behind struct wifiops, so that something else
+(e.g., a fake for testing) can drive this block without any hardware.
+*/
+
+struct wifiops {
+	/* Open a socket that link changes are pushed to. Returns the
+	socket, or -1 on error. */
+	int (*openlinks)(void);
+	/* Ask for the state of every link to be sent to the socket.
+	Returns 0 on success, and -1 on error. */
+	int (*requestlinks)(int fd);
+	/* Read pending link messages from the socket, calling setlink for
+	each (with operstate -1 if the link was removed). Returns 1 if any
+	call to setlink did, and 0 otherwise. */
+	int (*readlinks)(int fd, int (*setlink)(int index, const char *name,
+			int operstate));
+	/* Get the signal (dBm) and transmit bitrate (100 kbit/s) of the
+	station the link is connected to. Returns 0 on success, and -1 if
+	it isn't connected to one. */
+	int (*station)(int index, int *signal, unsigned int *bitrate);
+};
+
+/* States of the wireless interfaces, guarded by registrylock. */
+static struct link {
+	char name[IFNAMSIZ];
+	int index;
+	int operstate;
+} links[MAX_DEVICES];
+static unsigned int nlinks;
+/* The socket links are pushed to, or -1. */
+static int linkfd = -1;
+
+/* An attribute's payload and its size. */
+#define NLA_DATA(nla) ((void *)((char *)(nla) + NLA_HDRLEN))
+#define NLA_PAYLOAD(nla) ((size_t)(nla)->nla_len - NLA_HDRLEN)
+
+/* Netlink sequence numbers, so replies can be told apart. */
+static unsigned int nlseq;
+
+/* Send a netlink request of len bytes. Returns 0 on success, and -1 on
+error. */
+static int
+nlsend(int fd, struct nlmsghdr *nlh, size_t len)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+
+	nlh->nlmsg_len = (unsigned int)len;
+	nlh->nlmsg_seq = ++nlseq;
+	return sendto(fd, nlh, len, 0, (struct sockaddr *)&addr,
+			sizeof(addr)) == (ssize_t)len ? 0 : -1;
+}
+
+/* Append an attribute to a request in buf, which has *lenptr bytes so
+far. */
+static void
+nlputattr(char *buf, size_t *lenptr, unsigned short type, const void *data,
+		size_t size)
+{
+	struct nlattr *nla;
+
+	nla = (struct nlattr *)(buf + NLMSG_ALIGN(*lenptr));
+	nla->nla_type = type;
+	nla->nla_len = (unsigned short)(NLA_HDRLEN + size);
+	memcpy((char *)nla + NLA_HDRLEN, data, size);
+	*lenptr = NLMSG_ALIGN(*lenptr) + NLA_ALIGN(nla->nla_len);
+}
+
+/* Find the attribute of the given type among the attributes in
+[attrs, attrs + len). Returns it, or NULL if it isn't there. */
+static struct nlattr *
+nlgetattr(void *attrs, size_t len, unsigned short type)
+{
+	size_t step;
+	struct nlattr *nla;
+
+	for (nla = attrs; len >= (size_t)NLA_HDRLEN; len -= step) {
+		if (nla->nla_len < NLA_HDRLEN || nla->nla_len > len)
+			break;
+		if ((nla->nla_type & NLA_TYPE_MASK) == type)
+			return nla;
+		step = NLA_ALIGN(nla->nla_len);
+		if (step >= len)
+			break;
+		nla = (struct nlattr *)((char *)nla + step);
+	}
+	return NULL;
+}
+
+static int
+nlopenlinks(void)
+{
+	int fd;
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+	growrcvbuf(fd, LINKS_RCVBUF);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+nlrequestlinks(int fd)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req = {
+		.nlh = {
+			.nlmsg_type = RTM_GETLINK,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		},
+		.ifi = {
+			.ifi_family = AF_UNSPEC,
+		},
+	};
+
+	return nlsend(fd, &req.nlh, sizeof(req));
+}
+
+static int
+nlreadlinks(int fd, int (*setlink)(int, const char *, int))
+{
+	ssize_t n;
+	size_t len;
+	int operstate, changed;
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	struct nlattr *name, *state;
+	static char buf[16384];
+
+	changed = 0;
+	for (;;) {
+		n = recv(fd, buf, sizeof(buf), 0);
+		/* changes were dropped, so ask for every link's state */
+		if (n < 0 && errno == ENOBUFS) {
+			nlrequestlinks(fd);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len = (size_t)n;
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != RTM_NEWLINK
+					&& nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+			ifi = NLMSG_DATA(nlh);
+			name = nlgetattr(IFLA_RTA(ifi), IFLA_PAYLOAD(nlh),
+					IFLA_IFNAME);
+			if (name == NULL)
+				continue;
+			state = nlgetattr(IFLA_RTA(ifi), IFLA_PAYLOAD(nlh),
+					IFLA_OPERSTATE);
+			operstate = state == NULL ? IF_OPER_UNKNOWN
+					: *(unsigned char *)NLA_DATA(state);
+			if (nlh->nlmsg_type == RTM_DELLINK)
+				operstate = -1;
+			changed |= setlink(ifi->ifi_index, NLA_DATA(name),
+					operstate);
+		}
+	}
+	return changed;
+}
+
+/* Receive the replies to request seq, calling fn on each message. Returns
+0 once they are done, and -1 on error. */
+static int
+nlrecvreplies(int fd, unsigned int seq, void (*fn)(struct nlmsghdr *, void *),
+		void *arg)
+{
+	ssize_t n;
+	size_t len;
+	struct nlmsghdr *nlh;
+	static char buf[16384];
+
+	for (;;) {
+		n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return -1;
+		len = (size_t)n;
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error
+						== 0 ? 0 : -1;
+			fn(nlh, arg);
+			if (!(nlh->nlmsg_flags & NLM_F_MULTI))
+				return 0;
+		}
+	}
+}
+
+/* The nl80211 generic netlink socket and family ID. These are only used
+by the wifi block, so they don't need to be locked. */
+static int genlfd = -1;
+static unsigned short nl80211id;
+
+static void
+onfamily(struct nlmsghdr *nlh, void *arg)
+{
+	struct nlattr *id;
+
+	id = nlgetattr((char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+			nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+			CTRL_ATTR_FAMILY_ID);
+	if (id != NULL)
+		*(unsigned short *)arg = *(unsigned short *)NLA_DATA(id);
+}
+
+/* Open the generic netlink socket and look up nl80211. Returns 0 on
+success, and -1 on error. */
+static int
+opennl80211(void)
+{
+	size_t len;
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+	static char buf[256];
+
+	genlfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (genlfd < 0)
+		return -1;
+	memset(buf, 0, sizeof(buf));
+	nlh = (struct nlmsghdr *)buf;
+	nlh->nlmsg_type = GENL_ID_CTRL;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	genl = NLMSG_DATA(nlh);
+	genl->cmd = CTRL_CMD_GETFAMILY;
+	genl->version = 1;
+	len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlputattr(buf, &len, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME,
+			sizeof(NL80211_GENL_NAME));
+	if (nlsend(genlfd, nlh, len) < 0
+			|| nlrecvreplies(genlfd, nlh->nlmsg_seq, onfamily,
+			&nl80211id) < 0 || nl80211id == 0) {
+		close(genlfd);
+		genlfd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+struct stationinfo {
+	int found;
+	int signal;
+	unsigned int bitrate;
+};
+
+static void
+onstation(struct nlmsghdr *nlh, void *arg)
+{
+	struct nlattr *info, *attr, *rate;
+	struct stationinfo *sta = arg;
+
+	/* only the first station (the access point) matters */
+	if (sta->found)
+		return;
+	info = nlgetattr((char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+			nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+			NL80211_ATTR_STA_INFO);
+	if (info == NULL)
+		return;
+	attr = nlgetattr(NLA_DATA(info), NLA_PAYLOAD(info),
+			NL80211_STA_INFO_SIGNAL);
+	if (attr == NULL)
+		return;
+	sta->found = 1;
+	sta->signal = *(signed char *)NLA_DATA(attr);
+	sta->bitrate = 0;
+	attr = nlgetattr(NLA_DATA(info), NLA_PAYLOAD(info),
+			NL80211_STA_INFO_TX_BITRATE);
+	if (attr == NULL)
+		return;
+	rate = nlgetattr(NLA_DATA(attr), NLA_PAYLOAD(attr),
+			NL80211_RATE_INFO_BITRATE32);
+	if (rate != NULL) {
+		sta->bitrate = *(uint32_t *)NLA_DATA(rate);
+		return;
+	}
+	rate = nlgetattr(NLA_DATA(attr), NLA_PAYLOAD(attr),
+			NL80211_RATE_INFO_BITRATE);
+	if (rate != NULL)
+		sta->bitrate = *(uint16_t *)NLA_DATA(rate);
+}
+
+static int
+nlstation(int index, int *signal, unsigned int *bitrate)
+{
+	size_t len;
+	uint32_t ifindex;
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+	struct stationinfo sta = {0};
+	static char buf[256];
+
+	if (genlfd < 0 && opennl80211() < 0)
+		return -1;
+	memset(buf, 0, sizeof(buf));
+	nlh = (struct nlmsghdr *)buf;
+	nlh->nlmsg_type = nl80211id;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	genl = NLMSG_DATA(nlh);
+	genl->cmd = NL80211_CMD_GET_STATION;
+	len = NLMSG_LENGTH(GENL_HDRLEN);
+	ifindex = (uint32_t)index;
+	nlputattr(buf, &len, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+	if (nlsend(genlfd, nlh, len) < 0
+			|| nlrecvreplies(genlfd, nlh->nlmsg_seq, onstation,
+			&sta) < 0) {
+		/* start over next time */
+		close(genlfd);
+		genlfd = -1;
+		return -1;
+	}
+	if (!sta.found)
+		return -1;
+	*signal = sta.signal;
+	*bitrate = sta.bitrate;
+	return 0;
+}
+
+static const struct wifiops nlwifiops = {
+	.openlinks = nlopenlinks,
+	.requestlinks = nlrequestlinks,
+	.readlinks = nlreadlinks,
+	.station = nlstation,
+};
+static const struct wifiops *wifiops = &nlwifiops;
+
+/* Update the state of a link if it is a wireless interface. Returns 1
+if a wireless interface changed, and 0 otherwise (e.g., for the links of
+containers, which come and go all the time). Must be called with
+registrylock held. */
+static int
+setlink(int index, const char *name, int operstate)
+{
+	unsigned int i;
+
+	for (i = 0; i < nlinks && links[i].index != index; i++);
+	/* links can be renamed, so check the name even if it is known */
+	if (operstate < 0 || !devfind(&wirelessdevs, name)) {
+		if (i == nlinks)
+			return 0;
+		links[i] = links[--nlinks];
+		return 1;
+	}
+	if (i == nlinks) {
+		if (nlinks == MAX_DEVICES || strlen(name) >= IFNAMSIZ)
+			return 0;
+		nlinks++;
+	} else if (links[i].operstate == operstate
+			&& strcmp(links[i].name, name) == 0) {
+		return 0;
+	}
+	strcpy(links[i].name, name);
+	links[i].index = index;
+	links[i].operstate = operstate;
+	return 1;
+}
+
+static int
+onlinks(int fd, unsigned int events)
+{
+	int changed;
+
+	(void)events;
+	pthread_mutex_lock(&registrylock);
+	changed = wifiops->readlinks(fd, setlink);
+	pthread_mutex_unlock(&registrylock);
+	if (!changed)
+		return 0;
+	expire(wifi);
+	return 1;
+}
+
+/* Ask for the current states of the links. The kernel starts replying
+right away, so the replies can be read right away too. */
+static void
+requestlinks(void)
+{
+	if (linkfd >= 0 && wifiops->requestlinks(linkfd) == 0)
+		onlinks(linkfd, EPOLLIN);
+}
+
+/* Subscribe to link changes, and get the current states. */
+static void
+watchlinks(void)
+{
+	linkfd = wifiops->openlinks();
+	if (linkfd < 0)
+		return;
+	eaddwatch(linkfd, EPOLLIN, onlinks);
+	requestlinks();
+}
+
+/* Convert an operstate (see RFC 2863) to a string to print. */
+static const char *
+operstatestr(int operstate)
+{
+	static const char *const states[] = {
+		[IF_OPER_UNKNOWN] = "unknown",
+		[IF_OPER_NOTPRESENT] = "notpresent",
+		[IF_OPER_DOWN] = "down",
+		[IF_OPER_LOWERLAYERDOWN] = "lowerlayerdown",
+		[IF_OPER_TESTING] = "testing",
+		[IF_OPER_DORMANT] = "dormant",
+		[IF_OPER_UP] = "up",
+	};
+
+	if (operstate < 0 || (unsigned int)operstate >= LEN(states))
+		return "unknown";
+	return states[operstate];
+}
+
+static int
+probewifi(void)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&registrylock);
+	n = wirelessdevs.n;
+	pthread_mutex_unlock(&registrylock);
+	return n > 0;
+}
+
+static int
+wifi(struct strbuf *sb)
+{
+	int total, signal;
+	unsigned int i, n, bitrate, nsnap;
+	char connected[MAX_DEVICES] = {0};
+	struct astatus_wifi snap[ASTATUS_WIFI];
+	static struct link copy[MAX_DEVICES];
+
+	pthread_mutex_lock(&registrylock);
+	memcpy(copy, links, nlinks * sizeof(*links));
+	n = nlinks;
+	pthread_mutex_unlock(&registrylock);
+	/* print connected interfaces first... */
+	for (i = 0, total = 0, nsnap = 0; i < n; i++) {
+		if (copy[i].operstate != IF_OPER_UP || wifiops->station(
+				copy[i].index, &signal, &bitrate) < 0)
+			continue;
+		connected[i] = 1;
+		if (nsnap < ASTATUS_WIFI) {
+			snapname(snap[nsnap].name, copy[i].name,
+					strlen(copy[i].name));
+			snap[nsnap].connected = 1;
+			snap[nsnap].signal = signal;
+			snap[nsnap++].bitrate = bitrate;
+		}
+		if (total > 0)
+			total += sbputs(sb, SEPARATOR);
+		total += sbputs(sb, copy[i].name);
+		total += sbputc(sb, ' ');
+		total += sbputint(sb, signal);
+		total += sbputs(sb, "dBm ");
+		total += sbputint(sb, bitrate / 10);
+		total += sbputc(sb, 'M');
+	}
+	/* ...then the rest */
+	for (i = 0; i < n; i++) {
+		if (connected[i])
+			continue;
+		if (nsnap < ASTATUS_WIFI) {
+			snapname(snap[nsnap].name, copy[i].name,
+					strlen(copy[i].name));
+			snap[nsnap].connected = 0;
+			snap[nsnap].signal = 0;
+			snap[nsnap++].bitrate = 0;
+		}
+		if (total > 0)
+			total += sbputs(sb, SEPARATOR);
+		total += sbputs(sb, copy[i].name);
+		total += sbputc(sb, ' ');
+		total += sbputs(sb, operstatestr(copy[i].operstate));
+	}
+	pthread_mutex_lock(&snaplock);
+	memcpy(staged.wifi, snap, nsnap * sizeof(*snap));
+	staged.nwifi = nsnap;
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
+	return total;
+}
+
+/*
+Disks.
+
+The goal is to print out the utilization and available space for mount
+points that correspond to partitions on hardware devices (I call these
+"disks" even though they are just partitions...). It should also ignore
+some partitions that (probably) don't matter, like /boot.
+
+One of the challenges with this is that some partitions are mounted more
+than once, like btrfs subvolumes and bind mounts. Another is that some
+systems (e.g., container hosts) have thousands of mounts, so parsing
+/proc/mounts every refresh is expensive. The solution I went with was
+to keep an index of the disks, which is only rebuilt when the kernel
+says the mounts changed (/proc/mounts reports POLLPRI then). Disks are
+identified by their device number (st_rdev of the device file), so each
+one is only in the index once no matter how many times it is mounted.
+
+So, overall, when the mounts change:
+
+- Use /proc/mounts to find all mounted disks.
+- Ignore undesired disks (see shouldignoredisk).
+- Look up each disk's device number and name.
+- Sort them by device number and drop the duplicates.
+- Put them back in the order they were mounted in.
+
+And every refresh, print the first MAX_NUM_DISKS disks' info.
+
+An alert is raised if a disk is over 90% full (until it is under 88%).
+
+I read some busybox source before writing this section:
+https://git.busybox.net/busybox/tree/util-linux/mount.c#n2320 and
+https://git.busybox.net/busybox/tree/coreutils/df.c#n211.
+*/
+
+static struct disk {
+	dev_t dev; /* st_rdev of the device file */
+	ino_t ino; /* the device file's inode if it isn't a block device */
+	size_t order; /* position in /proc/mounts */
+	char *dir; /* (first) mount point */
+	char name[NAME_MAX + 1]; /* basename of the device file */
+} *diskindex;
+/* Number of disks in the index, and how many there is room for. */
+static size_t ndisks, disksroom;
+/* Held while the index is rebuilt, since io reads the disks' names. */
+static pthread_mutex_t disklock = PTHREAD_MUTEX_INITIALIZER;
+/* /proc/mounts, kept open to be watched. */
+static FILE *mounts;
+/* True if the index has to be rebuilt. */
+static int mountsdirty = 1;
+/* False if /proc/mounts can't be watched (e.g., in a fixture tree under
+root), in which case the index is rebuilt every refresh. */
+static int mountswatched;
+
+/* Predicate that matches disks from /dev that aren't under boot. */
+static int
+shouldignoredisk(const struct mntent *entptr)
+{
+	int devlen, bootlen;
+
+	/* no magic numbers */
+	devlen = strlen("/dev");
+	bootlen = strlen("/boot");
+	/* ignore file systems that aren't from /dev */
+	if (strncmp(entptr->mnt_fsname, "/dev", devlen) != 0)
+		return 1;
+	/* ignore anything mounted below /boot */
+	if (strncmp(entptr->mnt_dir, "/boot", bootlen) == 0)
+		return 1;
+	/* everything else is fine */
+	return 0;
+}
+
+/* qsort comparison function for disks by device, then order. */
+static int
+diskdevcmp(const void *a, const void *b)
+{
+	const struct disk *da = a, *db = b;
+
+	if (da->dev != db->dev)
+		return da->dev < db->dev ? -1 : 1;
+	if (da->ino != db->ino)
+		return da->ino < db->ino ? -1 : 1;
+	return da->order < db->order ? -1 : da->order > db->order;
+}
+
+/* qsort comparison function for disks by order. */
+static int
+diskordercmp(const void *a, const void *b)
+{
+	const struct disk *da = a, *db = b;
+
+	return da->order < db->order ? -1 : da->order > db->order;
+}
+
+/* Add a mount to the end of the index. Returns -1 if it is not a disk
+after all (or memory ran out), and 0 otherwise. Device files that aren't
+block devices (e.g., in a fixture tree under root) are identified by
+their inode instead. */
+static int
+adddisk(const struct mntent *ent, size_t order)
+{
+	size_t len;
+	struct disk *d;
+	struct stat st;
+	char *lastslash, *ptr;
+	static char fsname[PATH_MAX], path[PATH_MAX];
+
+	if (stat(rootpath(fsname, ent->mnt_fsname), &st) < 0)
+		return -1;
+	/* get the basename of the actual path */
+	ptr = realpath(fsname, path);
+	if (ptr == NULL)
+		return -1;
+	if (ndisks == disksroom) {
+		d = realloc(diskindex, (disksroom * 2 + 8) * sizeof(*d));
+		if (d == NULL)
+			return -1;
+		diskindex = d;
+		disksroom = disksroom * 2 + 8;
+	}
+	d = &diskindex[ndisks];
+	d->dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	d->ino = S_ISBLK(st.st_mode) ? 0 : st.st_ino;
+	d->order = order;
+	lastslash = strrchr(path, '/');
+	ptr = lastslash == NULL ? path : lastslash + 1;
+	len = strlen(ptr);
+	len = len > NAME_MAX ? NAME_MAX : len;
+	memcpy(d->name, ptr, len);
+	d->name[len] = '\0';
+	d->dir = strdup(rootpath(path, ent->mnt_dir));
+	if (d->dir == NULL)
+		return -1;
+	ndisks++;
+	return 0;
+}
+
+/* Rebuild the index from /proc/mounts. */
+static void
+indexdisks(void)
+{
+	size_t i, j, order;
+	struct mntent *entptr;
+
+	for (i = 0; i < ndisks; i++)
+		free(diskindex[i].dir);
+	ndisks = 0;
+	rewind(mounts);
+	/* busybox uses the gnu extension _r version */
+	for (order = 0; entptr = getmntent(mounts), entptr != NULL; order++) {
+		if (!shouldignoredisk(entptr))
+			adddisk(entptr, order);
+	}
+	countread(0, ftell(mounts));
+	if (ndisks == 0)
+		return;
+	/* keep the first mount of each device */
+	qsort(diskindex, ndisks, sizeof(*diskindex), diskdevcmp);
+	for (i = 1, j = 0; i < ndisks; i++) {
+		if (diskindex[i].dev == diskindex[j].dev
+				&& diskindex[i].ino == diskindex[j].ino)
+			free(diskindex[i].dir);
+		else
+			diskindex[++j] = diskindex[i];
+	}
+	ndisks = j + 1;
+	qsort(diskindex, ndisks, sizeof(*diskindex), diskordercmp);
+}
+
+static int
+onmounts(int fd, unsigned int events)
+{
+	(void)fd;
+	(void)events;
+	pthread_mutex_lock(&lock);
+	mountsdirty = 1;
+	pthread_mutex_unlock(&lock);
+	expire(disks);
+	return 1;
+}
+
+/* Open /proc/mounts and watch it for changes. */
+static void
+watchmounts(void)
+{
+	char path[PATH_MAX];
+
+	/* busybox also uses /etc/mtab; is that the same? */
+	mounts = setmntent(rootpath(path, "/proc/mounts"), "r");
+	if (mounts != NULL)
+		mountswatched = addwatch(fileno(mounts), EPOLLPRI,
+				onmounts) == 0;
+}
+
+/* printf("%d%c", *baseptr, *suffixptr) will be a human-readable
+representation of bytes (parameter) bytes in binary units. */
+static void
+frombytes(unsigned long int bytes, int *baseptr, char *suffixptr)
+{
+	unsigned int i;
+	static const char suffixes[] = {'B', 'k', 'M', 'G', 'T', 'P', 'E'};
+
+	for (i = 0; i < LEN(suffixes) && bytes > 1024; i++, bytes /= 1024);
+	*baseptr = (int)bytes;
+	*suffixptr = i < LEN(suffixes) ? suffixes[i] : '?';
+}
+
+/* Get the disk's info from statvfs and print it, and keep it in snap if
+that isn't NULL. */
+static int
+printadisk(struct strbuf *sb, const struct disk *d, int needsep,
+		struct astatus_disk *snap)
+{
+	int rc, pct, total;
+	unsigned long int size, avail, used;
+	int availbase;
+	char availsuffix;
+	char key[MAX_ALERT_KEY];
+	struct statvfs statbuf;
+
+	rc = statvfs(d->dir, &statbuf);
+	if (rc < 0 || statbuf.f_blocks == 0)
+		return 0;
+	/* compute the stats we want to show */
+	/* XXX will frsize ever != bsize? */
+	size = statbuf.f_frsize * statbuf.f_blocks;
+	avail = statbuf.f_frsize * statbuf.f_bavail;
+	used = size - avail;
+	pct = (int)(100ul * used / size);
+	frombytes(avail, &availbase, &availsuffix);
+	if (snap != NULL) {
+		snapname(snap->name, d->name, strlen(d->name));
+		snap->size = size;
+		snap->avail = avail;
+	}
+	/* print its info */
+	snprintf(key, sizeof(key), "%.32s full", d->name);
+	checkalert(key, pct >= 98 ? ALERT_CRITICAL : ALERT_WARNING, pct, 91,
+			88, "%.128s is %d%% full  (%d%c left)", d->name, pct,
+			availbase, availsuffix);
+	total = needsep ? sbputs(sb, SEPARATOR) : 0;
+	total += sbputs(sb, d->name);
+	total += sbputc(sb, ' ');
+	total += sbputint(sb, pct);
+	total += sbputs(sb, "% ");
+	total += sbputint(sb, availbase);
+	return total + sbputc(sb, availsuffix);
+}
+
+static int
+probedisks(void)
+{
+	return mounts != NULL;
+}
+
+static int
+disks(struct strbuf *sb)
+{
+	size_t i;
+	int rc, total, dirty;
+	unsigned int nsnap;
+	struct astatus_disk snap[ASTATUS_DISKS];
+
+	if (mounts == NULL)
+		return 0;
+	pthread_mutex_lock(&lock);
+	dirty = mountsdirty || !mountswatched;
+	mountsdirty = 0;
+	pthread_mutex_unlock(&lock);
+	if (dirty) {
+		pthread_mutex_lock(&disklock);
+		indexdisks();
+		pthread_mutex_unlock(&disklock);
+	}
+	nsnap = 0;
+	for (i = 0, total = 0; i < ndisks && i < MAX_NUM_DISKS; i++) {
+		rc = printadisk(sb, &diskindex[i], total > 0,
+				nsnap < ASTATUS_DISKS ? &snap[nsnap] : NULL);
+		if (rc > 0 && nsnap < ASTATUS_DISKS)
+			nsnap++;
+		total += rc;
+	}
+	pthread_mutex_lock(&snaplock);
+	memcpy(staged.disks, snap, nsnap * sizeof(*snap));
+	staged.ndisks = nsnap;
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
+	return total;
+}
+
+/*
+Memory utilization.
+
+/proc/meminfo has all of the required info.
+*/
+
+static int
+mem(struct strbuf *sb)
+{
+	long unsigned int pct, total, available;
+	static char meminfo[4096];
+
+	if (readfile("/proc/meminfo", meminfo, sizeof(meminfo)) < 0)
+		return 0;
+	if (getfield(meminfo, "MemTotal:", &total) < 0
+			|| getfield(meminfo, "MemAvailable:", &available) < 0
+			|| total == 0)
+		return 0;
+	pct = 100lu * (total - available) / total;
+	pthread_mutex_lock(&snaplock);
+	staged.memtotal = (uint64_t)total * 1024;
+	staged.memavailable = (uint64_t)available * 1024;
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
+	return sbputs(sb, "mem ") + sbputint(sb, pct) + sbputc(sb, '%');
+}
+
+/*
+System load.
+
+/proc/loadavg has all of the required info.
+*/
+
+static int
+load(struct strbuf *sb)
+{
+	size_t len;
+	unsigned int i;
+	unsigned long whole, hundredths;
+	uint32_t avgs[3];
+	const char *s, *end;
+	static char loadavg[128];
+
+	if (readfile("/proc/loadavg", loadavg, sizeof(loadavg)) < 0)
+		return 0;
+	for (i = 0, s = loadavg; i < LEN(avgs); i++, s = end) {
+		if ((s = parseulong(s, &whole)) == NULL || *s != '.'
+				|| (end = parseulong(s + 1, &hundredths))
+				!= s + 3)
+			break;
+		avgs[i] = (uint32_t)(whole * 100 + hundredths);
+	}
+	if (i == LEN(avgs)) {
+		pthread_mutex_lock(&snaplock);
+		memcpy(staged.load, avgs, sizeof(avgs));
+		stageddirty = 1;
+		pthread_mutex_unlock(&snaplock);
+	}
+	/* the kernel already prints it with two decimals */
+	len = strcspn(loadavg, " ");
+	if (len == 0)
+		return 0;
+	return sbputs(sb, "load ") + sbputmem(sb, loadavg, len);
+}
+
+/*
+Pressure stall information.
+
+/proc/pressure/{cpu,memory,io} have the share of time that some tasks
+were stalled waiting for each resource, averaged over the last 10, 60
+and 300 seconds; the block shows the 10 second averages.
+
+To notice stalls as they happen, a PSI trigger (PSI_TRIGGER) is written
+to each of them, and they are watched for EPOLLPRI, which the kernel
+reports when the trigger's threshold is crossed. The block is then
+collected right away, and alerts that the resource is stalled. A short
+stall hardly moves the 10 second average, so the alert is held for as
+long as the trigger keeps firing within 10 s, and then until the
+average falls below STALLED / 2 %, so a stall that goes on is flashed
+once and then marked. Triggers can only be registered on procfs (not on
+a fixture tree under root), and kernels before 6.5 only let privileged
+users register them at all; without them, the alert starts when the
+average reaches STALLED %.
+*/
+
+static const struct {
+	const char *name, *path;
+} resources[] = {
+	{ "cpu", "/proc/pressure/cpu" },
+	{ "mem", "/proc/pressure/memory" },
+	{ "io", "/proc/pressure/io" },
+};
+/* The trigger of each resource, or -1. */
+static int psifds[LEN(resources)] = { -1, -1, -1 };
+/* When each trigger last fired (CLOCK_MONOTONIC), guarded by lock. */
+static struct timespec psifired[LEN(resources)];
+
+static int
+onpressure(int fd, unsigned int events)
+{
+	unsigned int i;
+
+	for (i = 0; i < LEN(resources) && psifds[i] != fd; i++);
+	if (i == LEN(resources))
+		return 0;
+	/* the cgroup or the file went away */
+	if (events & EPOLLERR) {
+		delwatch(fd);
+		close(fd);
+		psifds[i] = -1;
+		return 0;
+	}
+	pthread_mutex_lock(&lock);
+	clock_gettime(CLOCK_MONOTONIC, &psifired[i]);
+	pthread_mutex_unlock(&lock);
+	expire(pressure);
+	return 1;
+}
+
+/* Register a trigger for each resource. Failing is not fatal. */
+static void
+watchpressure(void)
+{
+	int fd;
+	unsigned int i;
+	struct statfs fs;
+	char path[PATH_MAX];
+
+	for (i = 0; i < LEN(resources); i++) {
+		fd = open(rootpath(path, resources[i].path),
+				O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		/* don't write the trigger over a regular file */
+		if (fstatfs(fd, &fs) < 0 || fs.f_type != PROC_SUPER_MAGIC
+				|| (write(fd, PSI_TRIGGER, sizeof(PSI_TRIGGER)) < 0
+				&& write(fd, PSI_TRIGGER_UNPRIVILEGED,
+					sizeof(PSI_TRIGGER_UNPRIVILEGED)) < 0)
+				|| addwatch(fd, EPOLLPRI, onpressure) < 0) {
+			close(fd);
+			continue;
+		}
+		psifds[i] = fd;
+	}
+}
+
+static int
+pressure(struct strbuf *sb)
+{
+	int total, fired;
+	unsigned int i;
+	unsigned long whole, hundredths;
+	long value;
+	const char *avg, *s;
+	char key[MAX_ALERT_KEY];
+	struct timespec now;
+	static char buf[256];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0, total = 0; i < LEN(resources); i++) {
+		if (readfile(resources[i].path, buf, sizeof(buf)) < 0
+				|| (avg = strstr(buf, "avg10=")) == NULL)
+			continue;
+		avg += 6;
+		pthread_mutex_lock(&lock);
+		fired = psifired[i].tv_sec != 0
+				&& now.tv_sec - psifired[i].tv_sec < 10;
+		pthread_mutex_unlock(&lock);
+		if ((s = parseulong(avg, &whole)) != NULL && *s == '.'
+				&& parseulong(s + 1, &hundredths) == s + 3) {
+			/* a recent trigger counts as reaching STALLED */
+			value = (long)(whole * 100 + hundredths);
+			if (fired && value < STALLED * 100)
+				value = STALLED * 100;
+			snprintf(key, sizeof(key), "%s stalled",
+					resources[i].name);
+			checkalert(key, ALERT_WARNING, value, STALLED * 100,
+					STALLED * 50, "tasks are stalled "
+					"waiting for %s", resources[i].name);
+		}
+		total += sbputs(sb, total > 0 ? " " : "psi ");
+		total += sbputs(sb, resources[i].name);
+		total += sbputc(sb, ' ');
+		/* the kernel already prints it with two decimals */
+		total += sbputmem(sb, avg, strcspn(avg, " \n"));
+	}
+	return total;
+}
+
+/*
+Counter rates.
+
+Disk and network throughput are computed from counters that the kernel
+only ever increases (e.g., sectors read) by remembering each device's
+counters from its last sample and dividing the difference by the time
+between the samples (taken from CLOCK_MONOTONIC, so setting the clock
+doesn't matter). A device's first sample has nothing to compare to, so
+it has no rates yet. Devices that weren't seen in a pass are forgotten.
+
+Some counters are only 32 bits wide (io_ticks in /proc/diskstats), so
+the caller gives each counter's width. A 32 bit counter that goes
+backwards has wrapped around, but a 64 bit one never does in practice,
+so it was reset (e.g., the driver was reloaded); the device is then
+sampled anew instead of showing a bogus rate.
+
+Each block has its own sampler, and a block is never collected twice at
+the same time, so samplers aren't locked.
+*/
+
+struct sampler {
+	struct sample {
+		char name[MAX_DEVICE_NAME];
+		unsigned long counters[MAX_COUNTERS];
+		struct timespec when;
+		int seen;
+	} samples[MAX_SAMPLED];
+	unsigned int n;
+};
+
+/* Put how much a counter that is bits wide went up from old to cur in
+*delta. Returns 0, or -1 if it was reset. */
+static int
+counterdelta(unsigned long old, unsigned long cur, unsigned int bits,
+		unsigned long *delta)
+{
+	if (cur >= old)
+		*delta = cur - old;
+	else if (bits == 32 && old <= UINT32_MAX)
+		*delta = (unsigned long)UINT32_MAX - old + cur + 1;
+	else
+		return -1;
+	return 0;
+}
+
+/* Record the n counters of the device called name (namelen bytes long),
+which are widths[i] bits wide, as sampled at *now, and put their
+per-second rates since the device's last sample in rates. Returns 0, or
+-1 if there are no rates yet. */
+static int
+sample(struct sampler *s, const char *name, size_t namelen,
+		const unsigned long *counters, const unsigned char *widths,
+		unsigned int n, const struct timespec *now,
+		unsigned long *rates)
+{
+	unsigned int i;
+	int reset;
+	long ms;
+	struct sample *sp;
+
+	for (i = 0; i < s->n; i++) {
+		if (strncmp(s->samples[i].name, name, namelen) == 0
+				&& s->samples[i].name[namelen] == '\0')
+			break;
+	}
+	sp = &s->samples[i];
+	if (i == s->n) {
+		if (s->n == MAX_SAMPLED || namelen >= MAX_DEVICE_NAME)
+			return -1;
+		s->n++;
+		memcpy(sp->name, name, namelen);
+		sp->name[namelen] = '\0';
+		memcpy(sp->counters, counters, n * sizeof(*counters));
+		sp->when = *now;
+		sp->seen = 1;
+		return -1;
+	}
+	sp->seen = 1;
+	ms = (now->tv_sec - sp->when.tv_sec) * 1000
+			+ (now->tv_nsec - sp->when.tv_nsec) / 1000000;
+	/* too soon to tell; keep the old sample so the time adds up */
+	if (ms <= 0)
+		return -1;
+	for (i = 0, reset = 0; i < n; i++) {
+		if (counterdelta(sp->counters[i], counters[i], widths[i],
+				&rates[i]) < 0)
+			reset = 1;
+		else
+			rates[i] = rates[i] * 1000 / (unsigned long)ms;
+		sp->counters[i] = counters[i];
+	}
+	sp->when = *now;
+	return reset ? -1 : 0;
+}
+
+/* Forget the devices that weren't sampled since the last sweep. */
+static void
+sweepsamples(struct sampler *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->n;) {
+		if (s->samples[i].seen)
+			s->samples[i++].seen = 0;
+		else
+			s->samples[i] = s->samples[--s->n];
+	}
+}
+
+/* Append a number of bytes per second, like "12M". */
+static int
+sbputrate(struct strbuf *sb, unsigned long rate)
+{
+	int base;
+	char suffix;
+
+	frombytes(rate, &base, &suffix);
+	return sbputint(sb, base) + sbputc(sb, suffix);
+}
+
+/*
+Disk throughput.
+
+For the disks that the disks block shows, /proc/diskstats has the number
+of sectors (always 512 bytes there) read and written, and the number of
+ms the disk was busy (io_ticks), which gives its utilization. An alert
+is raised if a disk is busy more than SATURATED% of the time (until it
+is 10% less busy).
+*/
+
+static int
+io(struct strbuf *sb)
+{
+	int total;
+	unsigned int i, n;
+	size_t namelen;
+	const char *p, *name;
+	unsigned long fields[10], rates[3], pct;
+	int have[MAX_NUM_DISKS] = {0};
+	char key[MAX_ALERT_KEY];
+	struct timespec now;
+	static char names[MAX_NUM_DISKS][NAME_MAX + 1];
+	static unsigned long counters[MAX_NUM_DISKS][3];
+	static const unsigned char widths[3] = { 64, 64, 32 };
+	static char diskstats[32768];
+	static struct sampler sampler;
+
+	pthread_mutex_lock(&disklock);
+	for (n = 0; n < ndisks && n < MAX_NUM_DISKS; n++)
+		strcpy(names[n], diskindex[n].name);
+	pthread_mutex_unlock(&disklock);
+	if (n == 0 || readfile("/proc/diskstats", diskstats,
+			sizeof(diskstats)) < 0)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* each line is: major minor name, then the statistics */
+	for (p = diskstats; *p != '\0'; p += strcspn(p, "\n"),
+			p += *p != '\0') {
+		if ((p = parseulongs(p, fields, 2)) == NULL)
+			break;
+		name = p + strspn(p, " \t");
+		namelen = strcspn(name, " \t\n");
+		for (i = 0; i < n; i++) {
+			if (strlen(names[i]) == namelen
+					&& memcmp(names[i], name, namelen) == 0)
+				break;
+		}
+		if (i == n || parseulongs(name + namelen, fields, 10) == NULL)
+			continue;
+		/* sectors read, sectors written, io_ticks */
+		counters[i][0] = fields[2];
+		counters[i][1] = fields[6];
+		counters[i][2] = fields[9];
+		have[i] = 1;
+	}
+	for (i = 0, total = 0; i < n; i++) {
+		if (!have[i] || sample(&sampler, names[i], strlen(names[i]),
+				counters[i], widths, 3, &now, rates) < 0)
+			continue;
+		/* io_ticks is ms, so ms per second / 10 is a percentage */
+		pct = rates[2] / 10 > 100 ? 100 : rates[2] / 10;
+		snprintf(key, sizeof(key), "%.32s busy", names[i]);
+		checkalert(key, ALERT_WARNING, (long)pct, SATURATED + 1,
+				SATURATED - 10, "%s is busy %lu%% of the time",
+				names[i], pct);
+		if (total > 0)
+			total += sbputs(sb, SEPARATOR);
+		total += sbputs(sb, names[i]);
+		total += sbputs(sb, " r");
+		total += sbputrate(sb, rates[0] * 512);
+		total += sbputs(sb, " w");
+		total += sbputrate(sb, rates[1] * 512);
+		total += sbputc(sb, ' ');
+		total += sbputint(sb, (long)pct);
+		total += sbputc(sb, '%');
+	}
+	sweepsamples(&sampler);
+	return total;
+}
+
+/*
+Network throughput.
+
+/proc/net/dev has the bytes received and transmitted by each interface.
+Interfaces that were idle since the last sample are left out (as is
+the loopback interface), so idle virtual interfaces (e.g., for
+containers) don't take up room; at most MAX_NUM_IFACES are shown. An
+alert is raised if an interface uses more than SATURATED% of its link
+speed (which wireless interfaces don't report), until it uses 10% less.
+*/
+
+/* Returns the speed of an interface's link in bytes per second, or 0 if
+it isn't known. */
+static unsigned long
+linkspeed(const char *name, size_t namelen)
+{
+	unsigned long mbits;
+	char path[PATH_MAX];
+	char buf[32];
+
+	snprintf(path, PATH_MAX, "/sys/class/net/%.*s/speed", (int)namelen,
+			name);
+	/* the read fails (with EINVAL) if the link is down */
+	if (readfile(path, buf, sizeof(buf)) < 0
+			|| parseulong(buf, &mbits) == NULL)
+		return 0;
+	return mbits * 1000000 / 8;
+}
+
+static int
+net(struct strbuf *sb)
+{
+	int total;
+	unsigned int shown;
+	size_t namelen;
+	const char *p, *name;
+	unsigned long fields[9], counters[2], rates[2], speed, pct;
+	static const unsigned char widths[2] = { 64, 64 };
+	char key[MAX_ALERT_KEY];
+	struct timespec now;
+	static char dev[32768];
+	static struct sampler sampler;
+
+	if (readfile("/proc/net/dev", dev, sizeof(dev)) < 0)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* skip the two header lines */
+	p = dev;
+	p += strcspn(p, "\n");
+	p += *p != '\0';
+	p += strcspn(p, "\n");
+	for (total = 0, shown = 0; *p != '\0'; p += strcspn(p, "\n")) {
+		p++;
+		name = p + strspn(p, " \t");
+		namelen = strcspn(name, ":\n");
+		if (name[namelen] != ':'
+				|| parseulongs(name + namelen + 1, fields, 9) == NULL
+				|| (namelen == 2 && memcmp(name, "lo", 2) == 0))
+			continue;
+		/* bytes received, bytes transmitted */
+		counters[0] = fields[0];
+		counters[1] = fields[8];
+		if (sample(&sampler, name, namelen, counters, widths, 2,
+				&now, rates) < 0 || (rates[0] == 0 && rates[1] == 0)
+				|| shown == MAX_NUM_IFACES)
+			continue;
+		speed = linkspeed(name, namelen);
+		if (speed > 0) {
+			pct = (rates[0] > rates[1] ? rates[0] : rates[1])
+					/ (speed / 100);
+			snprintf(key, sizeof(key), "%.*s saturated",
+					(int)namelen > 32 ? 32 : (int)namelen,
+					name);
+			checkalert(key, ALERT_WARNING, (long)pct,
+					SATURATED + 1, SATURATED - 10,
+					"%.*s is using %lu%% of its link",
+					(int)namelen, name, pct);
+		}
+		if (total > 0)
+			total += sbputs(sb, SEPARATOR);
+		total += sbputmem(sb, name, namelen);
+		total += sbputs(sb, " rx");
+		total += sbputrate(sb, rates[0]);
+		total += sbputs(sb, " tx");
+		total += sbputrate(sb, rates[1]);
+		shown++;
+	}
+	sweepsamples(&sampler);
+	return total;
+}
+
+/*
+ALSA volume & mute status.
+
+This part requires calling the correct sequence of libasound
+functions. I got that sequence of functions from these patches:
+https://tools.suckless.org/slstatus/patches/alsa/slstatus-alsa-4bd78c9.patch
+and
+https://tools.suckless.org/slstatus/patches/alsa/slstatus-alsa-mute-1.0.diff.
+
+The mixer is opened once and kept open. Its poll descriptors are watched
+by the event loop, and snd_mixer_handle_events
+updates the element's values when the volume or mute status changes, so
+reading them here doesn't touch the sound card. If the mixer goes away
+(e.g., a USB sound card is unplugged), it is closed and reopened on the
+next refresh.
+
+XXXX Not too sure on the correct cleanup operations.
+*/
+
+/* The mixer, or NULL if it isn't open. */
+static snd_mixer_t *mixer;
+/* ALSA_MIXER within mixer. */
+static snd_mixer_elem_t *mixerelem;
+/* The mixer's poll descriptors, which are in the event loop. */
+static int mixerfds[MAX_MIXER_FDS];
+static unsigned int nmixerfds;
+
+static void
+closemixer(void)
+{
+	if (mixer == NULL)
+		return;
+	while (nmixerfds > 0)
+		delwatch(mixerfds[--nmixerfds]);
+	snd_mixer_free(mixer);
+	snd_mixer_detach(mixer, ALSA_DEVICE);
+	snd_mixer_close(mixer);
+	mixer = NULL;
+	mixerelem = NULL;
+	/* there is no mixer to show the volume of anymore */
+	unstage(alsa);
+}
+
+/* Open the mixer and find ALSA_MIXER within it. Returns 0 on success,
+and -1 otherwise. */
+static int
+openmixer(void)
+{
+	int rc;
+	snd_mixer_selem_id_t *mixerid;
+
+	/* XXX how much error checking is necessary? */
+	rc = snd_mixer_open(&mixer, 0);
+	if (rc != 0) {
+		mixer = NULL;
+		return -1;
+	}
+	rc = snd_mixer_attach(mixer, ALSA_DEVICE);
+	if (rc != 0) {
+		snd_mixer_close(mixer);
+		mixer = NULL;
+		return -1;
+	}
+	rc = snd_mixer_selem_register(mixer, NULL, NULL);
+	if (rc != 0)
+		goto fail;
+	rc = snd_mixer_load(mixer);
+	if (rc != 0)
+		goto fail;
+	snd_mixer_selem_id_alloca(&mixerid);
+	snd_mixer_selem_id_set_name(mixerid, ALSA_MIXER);
+	snd_mixer_selem_id_set_index(mixerid, 0);
+	mixerelem = snd_mixer_find_selem(mixer, mixerid);
+	if (mixerelem == NULL)
+		goto fail;
+	return 0;
+fail:	closemixer();
+	return -1;
+}
+
+/* Add the mixer's poll descriptors to pfds, which has room for space
+more. Returns the number added. */
+static unsigned int
+mixerpollfds(struct pollfd *pfds, unsigned int space)
+{
+	int rc;
+
+	if (mixer == NULL)
+		return 0;
+	rc = snd_mixer_poll_descriptors_count(mixer);
+	if (rc <= 0 || (unsigned int)rc > space)
+		return 0;
+	rc = snd_mixer_poll_descriptors(mixer, pfds, (unsigned int)rc);
+	return rc < 0 ? 0 : (unsigned int)rc;
+}
+
+/* Handle the results of polling the descriptors from mixerpollfds.
+Returns 1 if the mixer changed (or went away), and 0 otherwise. */
+static int
+mixerevents(struct pollfd *pfds, unsigned int npfds)
+{
+	int rc;
+	unsigned short revents;
+
+	if (mixer == NULL || npfds == 0)
+		return 0;
+	rc = snd_mixer_poll_descriptors_revents(mixer, pfds, npfds, &revents);
+	if (rc < 0 || revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		closemixer();
+		return 1;
+	}
+	if (!(revents & POLLIN))
+		return 0;
+	if (snd_mixer_handle_events(mixer) < 0)
+		closemixer();
+	return 1;
+}
+
+/* Event loop handler for the mixer's poll descriptors. The EPOLL* and
+POLL* event bits have the same values. */
+static int
+onmixer(int fd, unsigned int events)
+{
+	unsigned int i, n;
+	struct pollfd pfds[MAX_MIXER_FDS];
+
+	n = mixerpollfds(pfds, MAX_MIXER_FDS);
+	for (i = 0; i < n; i++)
+		pfds[i].revents = pfds[i].fd == fd ? (short)events : 0;
+	if (!mixerevents(pfds, n))
+		return 0;
+	/* see if it (or another card) can be opened again */
+	if (mixer == NULL)
+		needprobe = 1;
+	expire(alsa);
+	return 1;
+}
+
+/* Open the mixer and add its poll descriptors to the event loop.
+Returns 0 on success, and -1 otherwise. */
+static int
+watchmixer(void)
+{
+	unsigned int i, n;
+	struct pollfd pfds[MAX_MIXER_FDS];
+
+	if (openmixer() < 0)
+		return -1;
+	n = mixerpollfds(pfds, MAX_MIXER_FDS);
+	for (i = 0; i < n; i++) {
+		eaddwatch(pfds[i].fd, (unsigned int)pfds[i].events, onmixer);
+		mixerfds[nmixerfds++] = pfds[i].fd;
+	}
+	return 0;
+}
+
+static int
+probealsa(void)
+{
+	return mixer != NULL || watchmixer() == 0;
+}
+
+static int
+alsa(struct strbuf *sb)
+{
+	int rc;
+	long int min, max, vol;
+	int sw;
+
+	if (mixer == NULL)
+		return 0;
+	rc = snd_mixer_selem_get_playback_volume_range(mixerelem, &min, &max);
+	if (rc != 0)
+		return 0;
+	rc = snd_mixer_selem_get_playback_volume(mixerelem,
+			SND_MIXER_SCHN_MONO, &vol);
+	if (rc != 0)
+		return 0;
+	rc = snd_mixer_selem_get_playback_switch(mixerelem, 0, &sw);
+	if (rc != 0)
+		return 0;
+	max -= min;
+	vol -= min;
+	pthread_mutex_lock(&snaplock);
+	staged.volume = (int32_t)(100l * vol / max);
+	staged.muted = !sw;
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
+	if (sw)
+		return sbputs(sb, "vol ") + sbputint(sb, 100l * vol / max)
+				+ sbputc(sb, '%');
+	else
+		return sbputs(sb, "vol muted");
+}
+
+/*
+Battery states and capacities.
+
+/sys/class/power_supply contains all power-related devices (which the
+device registry keeps track of). Each one's ./uevent has all of its
+properties as KEY=VALUE lines, so a supply costs one read per refresh
+instead of one per property. Batteries have POWER_SUPPLY_TYPE=Battery;
+other supplies are skipped from then on (see otherpsus).
+
+The time left until a battery is empty (or full, while charging) comes
+from its energy and power (or charge and current, depending on the
+driver), when it reports them.
+
+When a battery that isn't charging is very low (< 5%), a critical alert
+is raised (until it is over 6% or charging).
+*/
+
+/* Convert the first letter of POWER_SUPPLY_STATUS to a symbol to
+print. */
+static char
+batterychar(char ch)
+{
+	switch (ch) {
+	case 'C':
+		return '+';
+	case 'D':
+		return '-';
+	case 'I':
+		return 'o';
+	case 'F':
+		return '=';
+	default: /* 'U' */
+		return '?';
+	}
+}
+
+/* Convert the first letter of POWER_SUPPLY_STATUS to a snapshot's
+status. */
+static int32_t
+batterystatus(char ch)
+{
+	switch (ch) {
+	case 'C':
+		return ASTATUS_CHARGING;
+	case 'D':
+		return ASTATUS_DISCHARGING;
+	case 'I':
+	case 'N':
+		return ASTATUS_NOT_CHARGING;
+	case 'F':
+		return ASTATUS_FULL;
+	default:
+		return ASTATUS_UNKNOWN;
+	}
+}
+
+/* Returns the minutes left until a battery is empty, or full if it is
+charging, or -1 if it doesn't say. */
+static long
+minutesleft(const char *uevent, int charging)
+{
+	unsigned int i;
+	unsigned long now, full, rate;
+	static const char *const keys[][3] = {
+		{ "POWER_SUPPLY_ENERGY_NOW=", "POWER_SUPPLY_ENERGY_FULL=",
+			"POWER_SUPPLY_POWER_NOW=" },
+		{ "POWER_SUPPLY_CHARGE_NOW=", "POWER_SUPPLY_CHARGE_FULL=",
+			"POWER_SUPPLY_CURRENT_NOW=" },
+	};
+
+	for (i = 0; i < LEN(keys); i++) {
+		if (getfield(uevent, keys[i][0], &now) == 0
+				&& getfield(uevent, keys[i][1], &full) == 0
+				&& getfield(uevent, keys[i][2], &rate) == 0
+				&& rate > 0)
+			break;
+	}
+	if (i == LEN(keys) || (charging && full < now))
+		return -1;
+	return (long)((charging ? full - now : now) * 60 / rate);
+}
+
+/* Print information about a device if it is a battery, and a separator
+if needed, and keep it in snap if that isn't NULL. Returns the number of
+bytes printed, or -1 if the device isn't a battery. Some batteries have
+excessively long names (e.g., PlayStation controllers), so long names
+are truncated after the final hyphen. */
+static int
+battery(struct strbuf *sb, const char *name, int needsep,
+		struct astatus_battery *snap)
+{
+	int total, namelen;
+	long left;
+	const char *lastdash, *type, *status;
+	unsigned long capacity;
+	char ch;
+	char key[MAX_ALERT_KEY];
+	static char path[PATH_MAX];
+	static char uevent[2048];
+
+	snprintf(path, PATH_MAX, BATTERY_PREFIX "%s/uevent", name);
+	if (readfile(path, uevent, sizeof(uevent)) < 0
+			|| (type = findfield(uevent, "POWER_SUPPLY_TYPE=")) == NULL)
+		return 0;
+	if (strncmp(type, "Battery\n", 8) != 0)
+		return -1;
+	if (getfield(uevent, "POWER_SUPPLY_CAPACITY=", &capacity) < 0
+			|| (status = findfield(uevent,
+				"POWER_SUPPLY_STATUS=")) == NULL)
+		return 0;
+	ch = status[0];
+	lastdash = strrchr(name, '-');
+	namelen = lastdash == NULL ? (int)strlen(name) : (int)(lastdash - name);
+	if (needsep)
+		total = sbputs(sb, SEPARATOR);
+	else
+		total = 0;
+	total += sbputmem(sb, name, namelen);
+	total += sbputc(sb, ' ');
+	total += sbputc(sb, batterychar(ch));
+	total += sbputint(sb, (long)capacity);
+	total += sbputc(sb, '%');
+	left = ch == 'C' || ch == 'D' ? minutesleft(uevent, ch == 'C') : -1;
+	if (snap != NULL) {
+		snapname(snap->name, name, (size_t)namelen);
+		snap->capacity = (int32_t)capacity;
+		snap->status = batterystatus(ch);
+		snap->minutesleft = (int32_t)left;
+	}
+	if (left >= 0) {
+		total += sbputc(sb, ' ');
+		total += sbputint(sb, left / 60);
+		total += sbputc(sb, ':');
+		total += sbputc(sb, '0' + left % 60 / 10);
+		total += sbputc(sb, '0' + left % 10);
+	}
+	snprintf(key, sizeof(key), "%.*s low", namelen > 32 ? 32 : namelen,
+			name);
+	checkalert(key, ALERT_CRITICAL, ch == 'C' ? 100 : (long)capacity, 4,
+			6, "%.*s is running critically low (%lu%%)", namelen,
+			name, capacity);
+	return total;
+}
+
+/* Sort out the power supplies that aren't batteries (see otherpsus).
+Returns 1 if any are left. */
+static int
+probebatteries(void)
+{
+	unsigned int i, n;
+	const char *type;
+	char path[PATH_MAX];
+	static char uevent[2048];
+	static struct devlist devs;
+
+	copydevices(&devs, &powersupplies, &otherpsus);
+	for (i = 0, n = 0; i < devs.n; i++) {
+		snprintf(path, PATH_MAX, BATTERY_PREFIX "%s/uevent",
+				devs.names[i]);
+		if (readfile(path, uevent, sizeof(uevent)) >= 0
+				&& (type = findfield(uevent,
+					"POWER_SUPPLY_TYPE=")) != NULL
+				&& strncmp(type, "Battery\n", 8) != 0) {
+			pthread_mutex_lock(&registrylock);
+			devadd(&otherpsus, devs.names[i]);
+			pthread_mutex_unlock(&registrylock);
+			continue;
+		}
+		n++;
+	}
+	return n > 0;
+}
+
+static int
+batteries(struct strbuf *sb)
+{
+	int rc, total, needsep;
+	unsigned int i, nsnap;
+	struct astatus_battery snap[ASTATUS_BATTERIES];
+	static struct devlist devs;
+
+	copydevices(&devs, &powersupplies, &otherpsus);
+	for (i = 0, needsep = rc = total = 0, nsnap = 0; i < devs.n; i++) {
+		rc = battery(sb, devs.names[i], needsep,
+				nsnap < ASTATUS_BATTERIES ? &snap[nsnap] : NULL);
+		if (rc < 0) {
+			pthread_mutex_lock(&registrylock);
+			devadd(&otherpsus, devs.names[i]);
+			pthread_mutex_unlock(&registrylock);
+			continue;
+		}
+		if (rc > 0 && nsnap < ASTATUS_BATTERIES)
+			nsnap++;
+		needsep = rc > 0 ? 1 : needsep;
+		total += rc;
+	}
+	pthread_mutex_lock(&snaplock);
+	memcpy(staged.batteries, snap, nsnap * sizeof(*snap));
+	staged.nbatteries = nsnap;
+	stageddirty = 1;
+	pthread_mutex_unlock(&snaplock);
+	return total;
+}
+
+/*
+Date & time.
+
+ctime(3) has a nice format, but I don't care about seconds (which occur
+after the last colon). Since seconds aren't shown, the block only needs
+to be collected when the minute changes. A CLOCK_REALTIME timer is armed
+for the start of the next minute, and TFD_TIMER_CANCEL_ON_SET makes it
+fire early if the clock is set (e.g., by NTP or after resuming), so the
+minute shown is never stale.
+*/
+
+static int
+datetime(struct strbuf *sb)
+{
+	time_t now;
+	char buffer[26];
+
+	time(&now);
+	ctime_r(&now, buffer);
+	*strrchr(buffer, ':') = '\0';
+	return sbputs(sb, buffer);
+}
+
+/* Arm the timer for the start of the next minute. */
+static void
+armclock(int fd)
+{
+	struct timespec now;
+	struct itimerspec its = {0};
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	its.it_value.tv_sec = (now.tv_sec / 60 + 1) * 60;
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+			&its, NULL) < 0)
+		die("timerfd_settime:");
+}
+
+/* The read fails with ECANCELED when the clock was set, but either way
+the timer has to be armed for the (new) next minute. */
+static int
+onclock(int fd, unsigned int events)
+{
+	uint64_t expirations;
+
+	(void)events;
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN)
+		return 0;
+	armclock(fd);
+	expire(datetime);
+	return 1;
+}
+
+static void
+watchclock(void)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		die("timerfd_create:");
+	armclock(fd);
+	eaddwatch(fd, EPOLLIN, onclock);
+}
+
+/*
+The array of status functions to iterate over.
+
+Each block has its own refresh interval (in ms), since, e.g., disks fill
+up much slower than the load changes. Its text is kept in its own
+segment between refreshes, and the status line is put back together from
+the segments each time, so only the blocks that are due (or have been
+expired by an event) are collected again. An interval of 0 means the
+block is only collected when it is expired.
+
+Blocks that might block (e.g., statvfs on a failing disk) are collected
+on worker threads. Each refresh waits up to BLOCK_DEADLINE ms for them,
+and blocks that aren't done by then are shown with their last text,
+marked with STALE_PREFIX, and fixed up once they finish. A block is
+never collected twice at the same time.
+
+Not every block has something to show on every system (e.g., a desktop
+without batteries). A block can name its source, a file that has to
+exist, and a probe, which says whether there is anything to show; the
+blocks are probed at startup, and again after a device comes or goes or
+HUP is received (see needprobe), and only the active ones are collected,
+so the loop doesn't keep looking for what isn't there. A block whose
+function config.mk left out (see ONLYIF) is never active.
+
+XXX I'm not really consistent about whether these are "blocks" or
+"monitor" or something else.
+*/
+
+static struct block {
+	const char *const name;
+	int (*const fn)(struct strbuf *);
+	const int interval;
+	const int async; /* collect on a worker thread */
+	const char *const source; /* file that has to exist, if any */
+	int (*const probe)(void); /* whether there is anything to show */
+	/* the rest is filled in at runtime */
+	int active; /* see probeblocks */
+	struct strbuf scratch; /* fn's text, before it is copied to seg */
+	int expired;
+	struct timespec due; /* CLOCK_MONOTONIC */
+	int fetch; /* read its files ahead (see ringread) */
+	int awaited; /* dispatched by the last collect */
+	/* guarded by lock */
+	struct strbuf seg;
+	int running;
+	struct profile prof;
+} blocks[] = {
+	{ .name = "wifi", .fn = ONLYIF(USE_WIFI, wifi),
+		.interval = INTERVAL, .async = 1,
+		.probe = ONLYIF(USE_WIFI, probewifi) },
+	{ .name = "net", .fn = ONLYIF(USE_NET, net),
+		.interval = INTERVAL, .async = 1, .source = "/proc/net/dev" },
+	{ .name = "disks", .fn = ONLYIF(USE_DISKS, disks),
+		.interval = 30000, .async = 1, .probe = probedisks },
+	{ .name = "io", .fn = ONLYIF(USE_IO, io),
+		.interval = INTERVAL, .async = 1, .source = "/proc/diskstats",
+		.probe = probedisks },
+	{ .name = "mem", .fn = mem,
+		.interval = INTERVAL, .async = 1, .source = "/proc/meminfo" },
+	{ .name = "load", .fn = load,
+		.interval = INTERVAL, .async = 1, .source = "/proc/loadavg" },
+	{ .name = "pressure", .fn = ONLYIF(USE_PRESSURE, pressure),
+		.interval = INTERVAL, .async = 1,
+		.source = "/proc/pressure/cpu" },
+	{ .name = "alsa", .fn = alsa,
+		.interval = 60000 /* changes are events */,
+		.probe = probealsa },
+	{ .name = "batteries", .fn = ONLYIF(USE_BATTERIES, batteries),
+		.interval = 15000, .async = 1,
+		.probe = ONLYIF(USE_BATTERIES, probebatteries) },
+	{ .name = "datetime", .fn = datetime,
+		.interval = 0 /* see watchclock */ },
+};
+
+/* Make fn's block due now. */
+static void
+expire(int (*fn)(struct strbuf *))
+{
+	unsigned int i;
+
+	for (i = 0; i < LEN(blocks); i++) {
+		if (blocks[i].fn == fn)
+			blocks[i].expired = 1;
+	}
+}
+
+/* Work out which blocks are active, and make the ones that just became
+active due now. */
+static void
+probeblocks(void)
+{
+	unsigned int i;
+	int active;
+	char path[PATH_MAX];
+
+	needprobe = 0;
+	for (i = 0; i < LEN(blocks); i++) {
+		active = blocks[i].fn != NULL
+				&& (blocks[i].source == NULL || access(rootpath(
+				path, blocks[i].source), R_OK) == 0)
+				&& (blocks[i].probe == NULL || blocks[i].probe());
+		if (active && !blocks[i].active)
+			blocks[i].expired = 1;
+		if (!active && blocks[i].active) {
+			pthread_mutex_lock(&lock);
+			dropalerts(&blocks[i]);
+			pthread_mutex_unlock(&lock);
+			unstage(blocks[i].fn);
+		}
+		blocks[i].active = active;
+	}
+}
+
+/* Whether the block owner's files should be read ahead (see
+ringread). */
+static int
+fetching(const void *owner)
+{
+	return ((const struct block *)owner)->fetch;
+}
+
+/* Make every block due now. */
+static void
+expireall(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < LEN(blocks); i++)
+		blocks[i].expired = 1;
+}
+
+/* Returns <0, 0, or >0 if *a is before, the same as, or after *b. */
+static int
+timespeccmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	if (a->tv_nsec != b->tv_nsec)
+		return a->tv_nsec < b->tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/* Add ms milliseconds to *ts. */
+static void
+timespecadd(struct timespec *ts, long ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += ms % 1000 * 1000000l;
+	if (ts->tv_nsec >= 1000000000l) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000l;
+	}
+}
+
+/* Call the block's function and copy its text to its segment. */
+static void
+runblock(struct block *b)
+{
+	struct timespec start;
+
+	if (profiling) {
+		pthread_setspecific(profkey, &b->prof);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+	sbreset(&b->scratch);
+	pthread_setspecific(ownerkey, b);
+	b->fn(&b->scratch);
+	pthread_setspecific(ownerkey, NULL);
+	if (profiling)
+		profile(&b->prof, &start);
+	pthread_mutex_lock(&lock);
+	sbreset(&b->seg);
+	sbputmem(&b->seg, b->scratch.s, b->scratch.len);
+	sweepalerts(b);
+	b->running = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+Worker threads.
+
+The main thread puts blocks in a queue, and the workers take them out
+and run them. Each time a worker finishes a block, it writes to an
+eventfd, which wakes up the main thread to publish the new text.
+*/
+
+static struct block *queue[LEN(blocks)];
+static unsigned int queuehead, queuelen;
+/* Signaled (with lock held) when a block is added to the queue. */
+static pthread_cond_t queuecond = PTHREAD_COND_INITIALIZER;
+static int donefd = -1;
+
+static void *
+work(void *arg)
+{
+	struct block *b;
+	uint64_t one = 1;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (queuelen == 0)
+			pthread_cond_wait(&queuecond, &lock);
+		b = queue[queuehead];
+		queuehead = (queuehead + 1) % LEN(queue);
+		queuelen--;
+		pthread_mutex_unlock(&lock);
+		runblock(b);
+		if (write(donefd, &one, sizeof(one)) < 0)
+			die("write:");
+	}
+	return NULL;
+}
+
+static int
+ondone(int fd, unsigned int events)
+{
+	uint64_t n;
+
+	(void)events;
+	return read(fd, &n, sizeof(n)) > 0;
+}
+
+/* Start the worker threads. Signals must be blocked first (see
+setupevents), so that only the main thread gets them. */
+static void
+startworkers(void)
+{
+	int rc;
+	unsigned int i;
+	pthread_t thread;
+
+	donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (donefd < 0)
+		die("eventfd:");
+	eaddwatch(donefd, EPOLLIN, ondone);
+	for (i = 0; i < NUM_WORKERS; i++) {
+		rc = pthread_create(&thread, NULL, work, NULL);
+		if (rc != 0) {
+			errno = rc;
+			die("pthread_create:");
+		}
+		pthread_detach(thread);
+	}
+}
+
+/* Put a block in the queue, unless it is already being collected.
+Returns 1 if it was queued, and 0 otherwise. */
+static int
+dispatch(struct block *b)
+{
+	int queued;
+
+	pthread_mutex_lock(&lock);
+	queued = !b->running;
+	if (queued) {
+		b->running = 1;
+		queue[(queuehead + queuelen++) % LEN(queue)] = b;
+		pthread_cond_signal(&queuecond);
+	}
+	pthread_mutex_unlock(&lock);
+	return queued;
+}
+
+/* Returns 1 if any block that the last collect dispatched is still being
+collected, and 0 otherwise. Blocks that were already running then (e.g.,
+stuck on a failing disk since an earlier refresh) don't count, or every
+refresh would wait for them. */
+static int
+anyrunning(void)
+{
+	unsigned int i;
+	int running;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0, running = 0; i < LEN(blocks); i++)
+		running |= blocks[i].awaited && blocks[i].running;
+	pthread_mutex_unlock(&lock);
+	return running;
+}
+
+/* Wait up to timeout ms (or forever if it is negative) for the blocks
+that the last collect dispatched, handling other events in the
+meantime. */
+static void
+awaitblocks(int timeout)
+{
+	long ms;
+	struct timespec now, deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespecadd(&deadline, timeout);
+	while (!done && anyrunning()) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (deadline.tv_sec - now.tv_sec) * 1000
+				+ (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (timeout >= 0 && ms <= 0)
+			return;
+		waitevents(timeout < 0 ? -1 : (int)ms);
+	}
+}
+
+/* Collect the blocks that are due (or dispatch them to the workers), and
+arm the timer for the next one. Blocks keep their phase, so they don't
+drift by however long collecting took. */
+static void
+collect(void)
 {
-	switch (ch) {
-	case 'C':
-		return '+';
-	case 'D':
-		return '-';
-	case 'I':
-		return 'o';
-	case 'F':
-		return '=';
-	default: /* 'U' */
-		return '?';
+	unsigned int i;
+	int havenext;
+	struct block *b;
+	struct timespec now, next;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* read the files of the blocks that are due all at once */
+	for (i = 0; i < LEN(blocks); i++) {
+		b = &blocks[i];
+		b->fetch = b->active && b->seg.s != NULL && (b->expired
+				|| (b->interval > 0
+				&& timespeccmp(&b->due, &now) <= 0));
+		b->awaited = 0;
+	}
+	ringread(fetching);
+	for (i = 0, havenext = 0; i < LEN(blocks); i++) {
+		b = &blocks[i];
+		if (!b->active)
+			continue;
+		if (b->seg.s == NULL) {
+			sbreset(&b->seg);
+			b->due = now;
+		}
+		if (b->expired || (b->interval > 0
+				&& timespeccmp(&b->due, &now) <= 0)) {
+			/* a block that is still running stays expired */
+			if (!b->async)
+				runblock(b);
+			if (!b->async || (b->awaited = dispatch(b)))
+				b->expired = 0;
+			else
+				b->expired = 1;
+		}
+		if (b->interval == 0)
+			continue;
+		while (timespeccmp(&b->due, &now) <= 0)
+			timespecadd(&b->due, b->interval);
+		if (!havenext || timespeccmp(&b->due, &next) < 0)
+			next = b->due;
+		havenext = 1;
 	}
+	if (havenext)
+		armtimer(&next);
 }
 
-/* Print information about a device if it is a battery, and a separator
-if needed. Some batteries have excessively long names (e.g., PlayStation
-controllers), so long names are truncated after the final hyphen. */
+/*
+X.
+
+With -x, the line is set as the root window's WM_NAME (as is, which is
+how dwm reads it) and its _NET_WM_NAME (as UTF8_STRING, since the line
+is UTF-8) through XCB. The requests are unchecked, so setting them
+doesn't wait for a reply; they are only queued, and the event loop
+flushes them in one write before it waits, so everything that was
+published since the last wait costs one write(2). Errors come back as
+events on the connection, which is watched: they are dropped, but if
+the connection breaks (e.g., the X server went away), astatus exits.
+*/
+
+static xcb_window_t xroot;
+static xcb_atom_t netwmname, utf8string;
+/* True if requests are queued that haven't been flushed. */
+static int xqueued;
+/* With -p, how long publishing the queued lines took (see publish). */
+static unsigned long long xpublishus;
+
 static int
-battery(FILE *stream, char *name, int needsep)
+onx(int fd, unsigned int events)
 {
-	int rc;
-	int total;
-	char *lastdash;
-	FILE *f;
-	int capacity;
-	char ch;
-	static char path[PATH_MAX];
+	xcb_generic_event_t *ev;
 
-	snprintf(path, PATH_MAX, BATTERY_PREFIX "%s/type", name);
-	f = fopen(path, "r");
-	if (f == NULL)
-		return 0;
-	ch = fgetc(f);
-	fclose(f);
-	if (ch != 'B')
-		return 0;
-	snprintf(path, PATH_MAX, BATTERY_PREFIX "%s/capacity", name);
-	f = fopen(path, "r");
-	if (f == NULL)
-		return 0;
-	rc = fscanf(f, "%d", &capacity);
-	fclose(f);
-	if (rc != 1)
-		return 0;
-	snprintf(path, PATH_MAX, BATTERY_PREFIX "%s/status", name);
-	f = fopen(path, "r");
-	if (f == NULL)
-		return 0;
-	ch = fgetc(f);
-	fclose(f);
-	if (ch == EOF)
-		return 0;
-	lastdash = strrchr(name, '-');
-	if (lastdash != NULL)
-		*lastdash = '\0';
-	if (needsep)
-		total = fprintf(stream, SEPARATOR);
+	(void)fd;
+	(void)events;
+	while ((ev = xcb_poll_for_event(conn)) != NULL)
+		free(ev);
+	if (xcb_connection_has_error(conn))
+		die("xcb: Lost the connection to the X server");
+	return 0;
+}
+
+/* Look up an atom (which waits for the server, so it is only done at
+startup). */
+static xcb_atom_t
+internatom(const char *name)
+{
+	xcb_atom_t atom;
+	xcb_intern_atom_reply_t *reply;
+
+	reply = xcb_intern_atom_reply(conn, xcb_intern_atom(conn, 0,
+			strlen(name), name), NULL);
+	if (reply == NULL)
+		return XCB_ATOM_NONE;
+	atom = reply->atom;
+	free(reply);
+	return atom;
+}
+
+/* Connect to the X server and watch the connection. */
+static void
+openx(void)
+{
+	int screen;
+	xcb_screen_iterator_t it;
+
+	screen = 0;
+	conn = xcb_connect(NULL, &screen);
+	if (xcb_connection_has_error(conn))
+		die("xcb_connect: Failed to open display");
+	it = xcb_setup_roots_iterator(xcb_get_setup(conn));
+	for (; screen > 0 && it.rem > 0; screen--)
+		xcb_screen_next(&it);
+	if (it.rem == 0)
+		die("xcb_connect: No such screen");
+	xroot = it.data->root;
+	netwmname = internatom("_NET_WM_NAME");
+	utf8string = internatom("UTF8_STRING");
+	eaddwatch(xcb_get_file_descriptor(conn), EPOLLIN, onx);
+}
+
+/* Queue setting the root window's names to the len bytes at name. */
+static void
+storename(const char *name, size_t len)
+{
+	xcb_change_property(conn, XCB_PROP_MODE_REPLACE, xroot,
+			XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, len, name);
+	if (netwmname != XCB_ATOM_NONE && utf8string != XCB_ATOM_NONE)
+		xcb_change_property(conn, XCB_PROP_MODE_REPLACE, xroot,
+				netwmname, utf8string, 8, len, name);
+	xqueued = 1;
+}
+
+/* Send the queued requests, if there are any. */
+static void
+flushx(void)
+{
+	struct timespec start;
+
+	if (!xqueued)
+		return;
+	if (profiling)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	if (xcb_flush(conn) <= 0)
+		die("xcb: Lost the connection to the X server");
+	xqueued = 0;
+	/* a write of the line is timed from queueing it to sending it */
+	if (profiling) {
+		profileus(&publishprof, xpublishus + sinceus(&start));
+		xpublishus = 0;
+	}
+}
+
+/*
+Publishing.
+
+Write a line to WM_NAME or stdout.
+
+Lines are written to stdout or to the clients (in daemon mode) through
+sinks. When stdout is a pipe or a socket (e.g., the FIFO dvtm reads), it
+is made non-blocking, and so are the clients' sockets, so a reader that
+stalls can't stall astatus (or the other clients) too. A line that can't
+be written right away waits in the sink's out until its fd is writable
+again, and a line published in the meantime replaces it, so a slow
+reader gets the newest line instead of a backlog of old ones. Only a
+line that was partly written has to be finished first (the newest line
+waits in pending then). Terminals and files are left blocking, since
+they don't stall like that (and a terminal is shared with the shell,
+which wouldn't expect it to be non-blocking).
+*/
+
+static struct sink {
+	int fd;
+	unsigned int events; /* always waited on (0 = not watched) */
+	/* the line being written (with its newline), how much of it has
+	been written, and the line to write after it */
+	struct strbuf out, pending;
+	size_t off;
+	int waiting; /* for fd to be writable */
+} stdoutsink = { .fd = STDOUT_FILENO }, clients[MAX_CLIENTS];
+static unsigned int nclients;
+
+static int onsink(int fd, unsigned int events);
+
+/* Wait (or stop waiting) for the sink's fd to be writable. */
+static void
+waitwritable(struct sink *sk, int wait)
+{
+	if (sk->waiting == wait)
+		return;
+	sk->waiting = wait;
+	if (sk->events != 0)
+		modwatch(sk->fd, sk->events | (wait ? EPOLLOUT : 0));
+	else if (wait)
+		eaddwatch(sk->fd, EPOLLOUT, onsink);
 	else
-		total = 0;
-	total += fprintf(stream, "%s %c%d%%", name, batterychar(ch), capacity);
-	if (capacity < 5 && ch != 'C')
-		snprintf(urgentmsg, sizeof(urgentmsg), "%s is running "
-				"critically low (%d%%)", name, capacity);
-	return total;
+		delwatch(sk->fd);
+}
+
+/* Write as much of out, and then pending, as the sink's fd takes.
+Returns 0, or -1 on error. */
+static int
+flushsink(struct sink *sk)
+{
+	ssize_t n;
+	struct strbuf tmp;
+
+	for (;;) {
+		while (sk->off < sk->out.len) {
+			n = write(sk->fd, sk->out.s + sk->off,
+					sk->out.len - sk->off);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && errno == EAGAIN) {
+				waitwritable(sk, 1);
+				return 0;
+			}
+			if (n < 0)
+				return -1;
+			sk->off += n;
+		}
+		sbreset(&sk->out);
+		sk->off = 0;
+		if (sk->pending.len == 0)
+			break;
+		tmp = sk->out;
+		sk->out = sk->pending;
+		sk->pending = tmp;
+	}
+	waitwritable(sk, 0);
+	return 0;
+}
+
+/* Close a client's connection and remove it. */
+static void
+dropclient(struct sink *sk)
+{
+	delwatch(sk->fd);
+	close(sk->fd);
+	free(sk->out.s);
+	free(sk->pending.s);
+	*sk = clients[--nclients];
+}
+
+/* Queue the len bytes at line (and a newline) to be written to the sink
+and write as much as possible. Returns 0, or -1 on error. */
+static int
+sinkline(struct sink *sk, const char *line, size_t len)
+{
+	struct strbuf *sb;
+
+	/* replace the waiting line, unless it is partly written */
+	sb = sk->off > 0 ? &sk->pending : &sk->out;
+	sbreset(sb);
+	sbputmem(sb, line, len);
+	sbputc(sb, '\n');
+	return flushsink(sk);
 }
 
+/* Write what is waiting when the fd is writable, and notice clients
+hanging up (they aren't supposed to send anything). */
 static int
-batteries(FILE *stream)
+onsink(int fd, unsigned int events)
 {
-	int rc, total, prefixlen, needsep;
 	unsigned int i;
-	glob_t globbuf;
+	ssize_t n;
+	char buf[256];
 
-	rc = glob(BATTERY_PREFIX "*", 0, NULL, &globbuf);
-	if (rc != 0)
+	if (fd == stdoutsink.fd && !daemonmode) {
+		if (flushsink(&stdoutsink) < 0)
+			die("write:");
 		return 0;
-	prefixlen = strlen(BATTERY_PREFIX);
-	for (i = 0, needsep = rc = total = 0; i < globbuf.gl_pathc; i++) {
-		rc = battery(stream, &globbuf.gl_pathv[i][prefixlen], needsep);
-		needsep = rc > 0 ? 1 : needsep;
-		total += rc;
 	}
-	globfree(&globbuf);
-	return total;
+	for (i = 0; i < nclients && clients[i].fd != fd; i++);
+	if (i == nclients)
+		return 0;
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		while ((n = read(fd, buf, sizeof(buf))) > 0);
+		if (n == 0 || errno != EAGAIN) {
+			dropclient(&clients[i]);
+			return 0;
+		}
+	}
+	if ((events & EPOLLOUT) && flushsink(&clients[i]) < 0)
+		dropclient(&clients[i]);
+	return 0;
 }
 
-/*
-Date & time.
+/* Make stdout non-blocking if it is a pipe or a socket. */
+static void
+setupstdout(void)
+{
+	int flags;
+	struct stat st;
 
-ctime(3) has a nice format, but I don't care about seconds (which occur
-after the last colon).
-*/
+	if (fstat(STDOUT_FILENO, &st) < 0
+			|| !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return;
+	flags = fcntl(STDOUT_FILENO, F_GETFL);
+	if (flags < 0 || fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) < 0)
+		die("fcntl:");
+}
 
-static int
-datetime(FILE *stream)
+static void
+publish(char *line)
 {
-	time_t now;
-	char buffer[26];
+	unsigned int i;
+	size_t len;
+	struct timespec start;
 
-	time(&now);
-	ctime_r(&now, buffer);
-	*strrchr(buffer, ':') = '\0';
-	return fprintf(stream, "%s", buffer);
+	if (profiling)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	len = strlen(line);
+	if (x) {
+		storename(line, len);
+		/* this only queues it, so the time is added to the write's
+		(see flushx) */
+		if (profiling)
+			xpublishus += sinceus(&start);
+		return;
+	} else if (daemonmode) {
+		/* backwards, since dropping a client moves the last one */
+		for (i = nclients; i-- > 0;) {
+			if (sinkline(&clients[i], line, len) < 0)
+				dropclient(&clients[i]);
+		}
+	} else if (sinkline(&stdoutsink, line, len) < 0) {
+		die("write:");
+	}
+	if (profiling)
+		profile(&publishprof, &start);
 }
 
 /*
-The array of status functions to iterate over.
-
-XXX I'm not really consistent about whether these are "blocks" or
-"monitor" or something else.
+The snapshot's shared memory object. Each user has their own, and
+astatus doesn't write one that belongs to someone else (see astatus.h).
+Only one astatus can write it at a time, so it is locked (with lockf)
+for as long as astatus runs, and if it is already locked, the snapshot
+isn't written at all.
 */
 
-/* A great example of C's ridiculous declaration syntax. */
-static int (*const blocks[])(FILE *) = {
-	wifi,
-	disks,
-	mem,
-	load,
-	alsa,
-	batteries,
-	datetime,
-};
+static struct astatus_snapshot *shm;
+static char shmname[ASTATUS_SHM_SIZE];
+
+static void
+opensnapshot(void)
+{
+	int fd;
+	void *p;
+	struct stat st;
+
+	astatus_shmname(shmname, geteuid());
+	fd = shm_open(shmname, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	/* someone else created it first, so it isn't ours to write */
+	if (fstat(fd, &st) < 0 || st.st_uid != geteuid()) {
+		close(fd);
+		return;
+	}
+	if (lockf(fd, F_TLOCK, 0) < 0 || ftruncate(fd, sizeof(*shm)) < 0
+			|| (p = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	/* fd stays open to keep the lock */
+	shm = p;
+	/* an astatus that died while writing it left seq odd */
+	if (shm->seq & 1)
+		__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy staged to the shared memory if it changed. */
+static void
+writesnapshot(void)
+{
+	uint32_t seq;
+	struct timespec now;
+
+	if (shm == NULL)
+		return;
+	pthread_mutex_lock(&snaplock);
+	if (stageddirty) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		staged.updated = now.tv_sec;
+		seq = shm->seq;
+		__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy((char *)shm + offsetof(struct astatus_snapshot, version),
+				(char *)&staged
+				+ offsetof(struct astatus_snapshot, version),
+				sizeof(staged)
+				- offsetof(struct astatus_snapshot, version));
+		__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+		stageddirty = 0;
+	}
+	pthread_mutex_unlock(&snaplock);
+}
+
+/* Write the profiles of the blocks and publish to path, or to stderr if
+path is NULL. */
+static void
+dumpprofile(const char *path)
+{
+	unsigned int i;
+	FILE *stream;
+
+	if (path == NULL) {
+		stream = stderr;
+	} else if ((stream = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "%s: %s: %s\n", argv0, path, strerror(errno));
+		return;
+	}
+	fprintf(stream, "%-10s %8s %10s %10s %8s %12s\n", "block", "calls",
+			"mean us", "max us", "opens", "bytes read");
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < LEN(blocks); i++)
+		printprofile(stream, blocks[i].name, &blocks[i].prof);
+	printprofile(stream, "publish", &publishprof);
+	pthread_mutex_unlock(&lock);
+	if (path == NULL)
+		fflush(stream);
+	else
+		fclose(stream);
+}
 
 /*
 Flashing urgent messages.
 
-This function will flash the message in urgentmsg according to the
-constants defined in the configuration macros. It does this using two
-buffers for "on" and "off" states, but there's probably a more efficient
-way to do this.
+When an alert is due (see Alerts), the status line is left up for
+HOLD_TIME ms, and then the alert's message is flashed URGENT_FLASHES
+times, switching between the "on" and "off" frames (which are built once
+per message) on a timer. Everything else keeps going in the meantime:
+the blocks are still collected (their text is published again once the
+flashing ends), and if the message being flashed changes or its alert
+ends, the frames are rebuilt or the flashing stops right away. Other
+alerts that are due are flashed after it, one at a time.
 */
 
+static enum {
+	FLASH_IDLE,
+	FLASH_HOLD, /* showing the status line before flashing */
+	FLASH_ON,
+	FLASH_OFF,
+} flashstate;
+/* The key of the alert being flashed, a copy of its message, the
+frames, and the number of times it has been flashed. */
+static char flashkey[MAX_ALERT_KEY];
+static char flashmsg[MAX_URGENT];
+static struct strbuf onframe, offframe;
+static int flashes;
+static int flashfd = -1;
+
+/* Arm the flash timer to go off in ms milliseconds (or disarm it if ms
+is 0). */
 static void
-flashurgentmsg(void)
+armflash(long ms)
 {
-	int i, bytes;
-	static char onbuf[2048 + 64], offbuf[2048 + 64];
+	struct itimerspec its = {
+		.it_value = *TIMESPEC(ms),
+	};
 
-	/* XXX there is probably a way to do this more efficiently and with
-	less buffers */
-	bytes = (int)strlen(urgentmsg);
-	snprintf(onbuf, sizeof(onbuf), URGENT_PREFIX " %s " URGENT_SUFFIX,
-			urgentmsg);
-	snprintf(offbuf, sizeof(offbuf), URGENT_PREFIX " %*s " URGENT_SUFFIX,
-			bytes, "");
-	for (i = 0; i < URGENT_FLASHES; i++) {
-		if (x) {
-			eXStoreName(dpy, DefaultRootWindow(dpy), onbuf);
-			XFlush(dpy);
-		} else {
-			printf("%s\n", onbuf);
-			fflush(stdout);
-		}
-		nanosleep(TIMESPEC(URGENT_FLASH_ON), NULL);
-		if (x) {
-			eXStoreName(dpy, DefaultRootWindow(dpy), offbuf);
-			XFlush(dpy);
-		} else {
-			printf("%s\n", offbuf);
-			fflush(stdout);
+	if (timerfd_settime(flashfd, 0, &its, NULL) < 0)
+		die("timerfd_settime:");
+}
+
+/* Build the frames for the message in flashmsg. */
+static void
+buildframes(void)
+{
+	size_t i, len;
+
+	len = strlen(flashmsg);
+	sbreset(&onframe);
+	sbputs(&onframe, URGENT_PREFIX " ");
+	sbputmem(&onframe, flashmsg, len);
+	sbputs(&onframe, " " URGENT_SUFFIX);
+	sbreset(&offframe);
+	sbputs(&offframe, URGENT_PREFIX " ");
+	for (i = 0; i < len; i++)
+		sbputc(&offframe, ' ');
+	sbputs(&offframe, " " URGENT_SUFFIX);
+}
+
+/* Stop flashing, marking the alert as flashed if it was flashed to the
+end. The lock must be held. */
+static void
+stopflash(int finished)
+{
+	struct alert *a;
+
+	if (finished && (a = findalert(flashkey)) != NULL) {
+		a->flashedseverity = a->severity;
+		clock_gettime(CLOCK_MONOTONIC, &a->flashed);
+	}
+	armflash(0);
+	flashstate = FLASH_IDLE;
+	/* the status line has to be published again afterwards */
+	lastlen = -1;
+}
+
+/* Start flashing the most severe alert that is due (the one that
+started first, if there is a tie), or follow changes to the one being
+flashed. */
+static void
+updateflash(void)
+{
+	unsigned int i;
+	struct alert *a, *next;
+	struct timespec now;
+
+	pthread_mutex_lock(&lock);
+	if (flashstate != FLASH_IDLE) {
+		if ((a = findalert(flashkey)) == NULL) {
+			stopflash(0);
+		} else if (strcmp(a->msg, flashmsg) != 0) {
+			strcpy(flashmsg, a->msg);
+			buildframes();
+			flashes = 0;
 		}
-		nanosleep(TIMESPEC(URGENT_FLASH_OFF), NULL);
 	}
+	if (flashstate != FLASH_IDLE) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0, next = NULL; i < nalerts; i++) {
+		a = &alerts[i];
+		if (alertdue(a, &now) && (next == NULL
+				|| a->severity > next->severity))
+			next = a;
+	}
+	if (next != NULL) {
+		strcpy(flashkey, next->key);
+		strcpy(flashmsg, next->msg);
+		buildframes();
+		flashes = 0;
+		flashstate = FLASH_HOLD;
+		armflash(HOLD_TIME);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Show the next frame. Returns 1 when the flashing is done, so that the
+status line is published again. */
+static int
+onflash(int fd, unsigned int events)
+{
+	uint64_t expirations;
+
+	(void)events;
+	if (read(fd, &expirations, sizeof(expirations)) < 0
+			|| flashstate == FLASH_IDLE)
+		return 0;
+	if (flashstate == FLASH_ON) {
+		publish(offframe.s);
+		flashstate = FLASH_OFF;
+		armflash(URGENT_FLASH_OFF);
+		return 0;
+	}
+	if (flashstate == FLASH_OFF && ++flashes == URGENT_FLASHES) {
+		pthread_mutex_lock(&lock);
+		stopflash(1);
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+	publish(onframe.s);
+	flashstate = FLASH_ON;
+	armflash(URGENT_FLASH_ON);
+	return 0;
+}
+
+static void
+watchflash(void)
+{
+	flashfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (flashfd < 0)
+		die("timerfd_create:");
+	eaddwatch(flashfd, EPOLLIN, onflash);
 }
 
 /*
-Iterate over blocks and insert separators where necessary.
+Put the alerts' markers and the blocks' segments together and insert
+separators where necessary.
 */
 
 static int
-printline(FILE *stream)
+printline(struct strbuf *sb)
 {
 	unsigned int i;
-	int rc, total;
+	int total, needsep;
 
-	total = 2;
-	fputc(' ', stream);
-	for (i = 0, rc = 0; i < LEN(blocks); i++) {
-		if (rc != 0) {
-			total += fprintf(stream, SEPARATOR);
+	total = sbputc(sb, ' ');
+	pthread_mutex_lock(&lock);
+	for (i = 0, needsep = 0; i < nalerts; i++) {
+		if (needsep)
+			total += sbputc(sb, ' ');
+		total += sbputs(sb, ALERT_MARKER);
+		total += sbputs(sb, alerts[i].key);
+		needsep = 1;
+	}
+	for (i = 0; i < LEN(blocks); i++) {
+		if (!blocks[i].active || blocks[i].seg.len == 0)
+			continue;
+		if (needsep)
+			total += sbputs(sb, SEPARATOR);
+		if (blocks[i].running)
+			total += sbputs(sb, STALE_PREFIX);
+		total += sbputmem(sb, blocks[i].seg.s, blocks[i].seg.len);
+		needsep = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return total + sbputc(sb, ' ');
+}
+
+/*
+Build the line in line and publish it, unless it is the same as
+the last line that was published. Consumers that need to hear from
+astatus periodically can set KEEPALIVE to have unchanged lines repeated
+at the first refresh after that long.
+*/
+
+static struct strbuf line, lastline;
+
+static void
+publishline(void)
+{
+	struct timespec now, keepalive;
+
+	sbreset(&line);
+	printline(&line);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	keepalive = lastpublished;
+	timespecadd(&keepalive, KEEPALIVE);
+	if ((long)line.len == lastlen
+			&& memcmp(line.s, lastline.s, line.len) == 0
+			&& (KEEPALIVE == 0 || timespeccmp(&now, &keepalive) < 0))
+		return;
+	publish(line.s);
+	sbreset(&lastline);
+	sbputmem(&lastline, line.s, line.len);
+	lastlen = line.len;
+	lastpublished = now;
+}
+
+/*
+Daemon mode.
+
+With -d, astatus collects the status once for everyone: instead of
+writing lines to stdout, it listens on socketpath and writes each new
+line to every client that is connected (and the current line to new
+clients right away). Each client has its own sink, so a client that
+doesn't keep up only misses lines, and doesn't hold up the others. With
+-c, astatus is a client that copies the lines it gets to stdout.
+
+The socket can be connected to by anyone who can reach it, so it is
+only as private as the directory it is in: $XDG_RUNTIME_DIR by default,
+which only its owner can enter, or one given with -S (e.g., a directory
+in /run for a daemon that several users share). A client only trusts a
+daemon that runs as root, as itself or as the owner of that directory,
+so a socket planted by someone else (e.g., in a world-writable
+directory) is refused.
+*/
+
+/* Set socketpath to $XDG_RUNTIME_DIR/SOCKET_NAME unless -S was given. */
+static void
+findsocket(void)
+{
+	static char path[PATH_MAX];
+	const char *dir;
+
+	if (socketpath != NULL)
+		return;
+	dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || dir[0] == '\0')
+		die("XDG_RUNTIME_DIR isn't set; use -S to give the socket");
+	if (snprintf(path, sizeof(path), "%s/" SOCKET_NAME, dir)
+			>= (int)sizeof(path))
+		die("%s: Path too long", dir);
+	socketpath = path;
+}
+
+/* Fill in addr for socketpath. */
+static void
+socketaddr(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(socketpath) >= sizeof(addr->sun_path))
+		die("%s: Path too long", socketpath);
+	strcpy(addr->sun_path, socketpath);
+}
+
+static int
+onconnect(int fd, unsigned int events)
+{
+	int cfd;
+	struct sink *sk;
+
+	(void)events;
+	while ((cfd = accept(fd, NULL, NULL)) >= 0) {
+		if (nclients == MAX_CLIENTS
+				|| fcntl(cfd, F_SETFL, O_NONBLOCK) < 0
+				|| fcntl(cfd, F_SETFD, FD_CLOEXEC) < 0
+				|| addwatch(cfd, EPOLLIN, onsink) < 0) {
+			close(cfd);
+			continue;
 		}
-		total += rc = blocks[i](stream);
+		sk = &clients[nclients++];
+		memset(sk, 0, sizeof(*sk));
+		sk->fd = cfd;
+		sk->events = EPOLLIN;
+		if (lastlen >= 0 && sinkline(sk, lastline.s, lastline.len) < 0)
+			dropclient(sk);
 	}
-	fputc(' ', stream);
-	return total;
+	return 0;
+}
+
+/* Listen on socketpath, unless another daemon already is. */
+static void
+listenclients(void)
+{
+	int fd;
+	struct stat st;
+	struct sockaddr_un addr;
+
+	socketaddr(&addr);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("socket:");
+	/* a socket that can't be connected to is left over, but anything
+	else at the path (e.g., a mistyped -S) isn't ours to remove */
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		die("%s: Another daemon is listening", socketpath);
+	if (lstat(socketpath, &st) == 0 && !S_ISSOCK(st.st_mode))
+		die("%s: Not a socket", socketpath);
+	if (unlink(socketpath) < 0 && errno != ENOENT)
+		die("unlink %s:", socketpath);
+	close(fd);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("socket:");
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("bind %s:", socketpath);
+	if (chmod(socketpath, 0666) < 0 || listen(fd, MAX_CLIENTS) < 0)
+		die("listen %s:", socketpath);
+	eaddwatch(fd, EPOLLIN, onconnect);
+	/* clients that hang up are noticed by write's EPIPE instead */
+	signal(SIGPIPE, SIG_IGN);
+}
+
+/* The credentials that SO_PEERCRED gets (struct ucred, which needs
+_GNU_SOURCE). */
+struct peercred {
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+};
+
+/* The daemon that the client is connected to. */
+static pid_t daemonpid;
+
+/* Whether a daemon running as uid may be trusted: it has to be root, the
+user running the client, or the owner of the socket's directory. */
+static int
+trusted(uid_t uid)
+{
+	char dir[PATH_MAX], *slash;
+	struct stat st;
+
+	if (uid == 0 || uid == getuid())
+		return 1;
+	strcpy(dir, socketpath);
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+	return stat(dir, &st) == 0 && st.st_uid == uid;
+}
+
+/* Pass USR1 on to the daemon, which is what actually refreshes (kill is
+async-signal-safe). */
+static void
+forwardrefresh(int sig)
+{
+	(void)sig;
+	kill(daemonpid, SIGUSR1);
+}
+
+/* Copy the lines from the daemon to stdout until it hangs up. Key
+bindings that send USR1 to every astatus (pkill -USR1 astatus) reach
+clients too, so a client passes it on to the daemon instead of dying,
+and ignores HUP, which is only meaningful to the daemon. */
+static int
+client(void)
+{
+	int fd;
+	ssize_t n, off, w;
+	socklen_t len;
+	struct sockaddr_un addr;
+	struct peercred peer;
+	struct sigaction sa;
+	char buf[4096];
+
+	socketaddr(&addr);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("socket:");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("connect %s:", socketpath);
+	len = sizeof(peer);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) < 0)
+		die("getsockopt %s:", socketpath);
+	if (!trusted(peer.uid))
+		die("%s: The daemon runs as user %ld, who doesn't own the "
+				"directory", socketpath, (long)peer.uid);
+	daemonpid = peer.pid;
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = forwardrefresh;
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		die("sigaction:");
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGHUP, &sa, NULL) < 0)
+		die("sigaction:");
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			die("read:");
+		for (off = 0; off < n; off += w) {
+			w = write(STDOUT_FILENO, buf + off, n - off);
+			if (w < 0 && errno == EINTR)
+				w = 0;
+			else if (w < 0)
+				die("write:");
+		}
+	}
+	die("%s: The daemon hung up", socketpath);
+	return 1;
 }
 
 /*
@@ -878,71 +4623,133 @@ Main.
 int
 main(int argc, char **argv)
 {
-	int i;
-	FILE *memstream;
-	struct sigaction action = {
-		.sa_handler = onsignal,
-	};
+	int i, once, clientmode;
+	struct timespec now, nextscan = {0};
 
 	/* Parse arguments */
 	argv0 = argv[0];
+	once = 0;
+	clientmode = 0;
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-v") == 0) {
 			fprintf(stderr, "astatus-" VERSION "\n");
 			return 0;
 		} else if (strcmp(argv[i], "-1") == 0) {
-			done = 1;
+			once = 1;
 		} else if (XALLOWED && strcmp(argv[i], "-x") == 0) {
 			x = 1;
 		} else if (strcmp(argv[i], "-s") == 0) {
 			x = 0;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			root = argv[++i];
+		} else if (strcmp(argv[i], "-p") == 0) {
+			profiling = 1;
+		} else if (strcmp(argv[i], "-d") == 0) {
+			daemonmode = 1;
+		} else if (strcmp(argv[i], "-c") == 0) {
+			clientmode = 1;
+		} else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+			socketpath = argv[++i];
 		} else {
-			fprintf(stderr, "usage: %s [-1] [-s]" XFLAG "\n",
-					argv[0]);
+			fprintf(stderr, "usage: %s [-1] [-p] [-s]" XFLAG
+					" [-d] [-S socket] [-r root]\n"
+					"       %s -c [-S socket]\n",
+					argv[0], argv[0]);
 			return 1;
 		}
 	}
+	/* the daemon writes to its clients, not to X */
+	if (daemonmode && x)
+		die("-d can't be combined with -x");
+	if (daemonmode || clientmode)
+		findsocket();
+	if (clientmode)
+		return client();
+
+	/* Set up the event loop (which also handles signals). */
+	if (profiling && (errno = pthread_key_create(&profkey, NULL)) != 0)
+		die("pthread_key_create:");
+	if ((errno = pthread_key_create(&ownerkey, NULL)) != 0)
+		die("pthread_key_create:");
+	setupevents();
+	watchclock();
+	watchflash();
+	if (USE_DISKS)
+		watchmounts();
+	if (USE_PRESSURE)
+		watchpressure();
+	if (USE_URING)
+		openring();
+	startworkers();
 
-	/* Install signal handlers. See comment about SA_RESTART. */
-	sigaction(SIGINT, &action, NULL);
-	sigaction(SIGTERM, &action, NULL);
-	sigaction(SIGUSR1, &action, NULL);
+	/* Set up X if needed, or keep a stalled reader from stalling us.
+	When writing once, the line has to get out before exiting, so
+	stdout stays blocking. */
+	if (daemonmode)
+		listenclients();
+	else if (x)
+		openx();
+	else if (!once)
+		setupstdout();
+	if (!once)
+		opensnapshot();
 
-	/* Set up X if needed. */
-	if (x)
-		dpy = eXOpenDisplay(NULL);
+	/* Start listening for devices before looking for them so none are
+	missed. */
+	openuevents();
+	scandevices();
+	if (USE_WIFI)
+		watchlinks();
 
-	/* The main loop. */
+	/* The main loop. Everything is due the first time through. */
+	expireall();
 	do {
-		/* Call printline and flush its output. */
-		if (x) {
-			memstream = efmemopen(xbuf, sizeof(xbuf), "w");
-			printline(memstream);
-			fclose(memstream);
-			eXStoreName(dpy, DefaultRootWindow(dpy), xbuf);
-			XFlush(dpy);
-		} else {
-			printline(stdout);
-			printf("\n");
-			fflush(stdout);
-		}
-		/* Either wait, or flash the urgent message if there is
-		one (and clear it after). */
-		if (urgentmsg[0] == '\0') {
-			nanosleep(TIMESPEC(INTERVAL), NULL);
-		} else {
-			nanosleep(TIMESPEC(HOLD_TIME), NULL);
-			flashurgentmsg();
-			urgentmsg[0] = '\0';
+		/* Without uevents, the only way to notice devices is to look,
+		which is done at most every INTERVAL ms, since probing (e.g.,
+		opening the mixer) can block the loop. Otherwise, the blocks
+		are only probed again after devices come or go (or HUP). */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ueventfd < 0 && timespeccmp(&nextscan, &now) <= 0) {
+			scandevices();
+			needprobe = 1;
+			nextscan = now;
+			timespecadd(&nextscan, INTERVAL);
 		}
-	} while (!done);
+		if (needprobe)
+			probeblocks();
+		/* Collect what's due and publish the line if it changed.
+		When writing once, there's no old text to fall back on, so
+		wait for everything. */
+		needrefresh = 0;
+		collect();
+		awaitblocks(once ? -1 : BLOCK_DEADLINE);
+		writesnapshot();
+		/* Start (or stop) flashing an urgent message, and leave the
+		line alone while one is flashing. */
+		updateflash();
+		if (flashstate == FLASH_IDLE || flashstate == FLASH_HOLD)
+			publishline();
+		/* Wait until it's time to refresh again, or, when writing
+		once, until the urgent message has been flashed. */
+		while (once && !done && flashstate != FLASH_IDLE)
+			waitevents(-1);
+		while (!once && !done && !needrefresh)
+			waitevents(-1);
+	} while (!once && !done);
 
-	/* Clear WM_NAME and close the display if using X. */
+	/* Clear WM_NAME and close the connection if using X. */
 	if (x) {
-		xbuf[0] = '\0';
-		eXStoreName(dpy, DefaultRootWindow(dpy), xbuf);
-		eXCloseDisplay(dpy);
+		storename("", 0);
+		flushx();
+		xcb_disconnect(conn);
 	}
 
+	/* Don't leave a stale snapshot or socket behind. */
+	if (shm != NULL)
+		shm_unlink(shmname);
+	if (daemonmode)
+		unlink(socketpath);
+	if (profiling)
+		dumpprofile(NULL);
 	return 0;
 }
@@ -0,0 +1,153 @@
+/*
+astatus snapshot
+
+While it runs, astatus keeps the raw values behind its line in a shared
+memory object (ASTATUS_SHM with the uid of the user running it, e.g.,
+/dev/shm/astatus-1000), so that other programs can use them without
+parsing the line. Shared memory objects are in one namespace for the
+whole host, so anyone could create that name first and fill it with
+values of their own: astatus_open only opens it if it belongs to the
+user whose snapshot it is supposed to be (and astatus doesn't write to
+one that isn't its own). The object holds a
+struct astatus_snapshot, which is rewritten in place whenever the values
+change, behind a sequence lock: seq is odd while it is being rewritten,
+and is incremented again once it is done. astatus_read takes a
+consistent copy of it without any system calls or locks, by copying it
+until seq was even and didn't change during the copy.
+
+The layout only changes together with ASTATUS_SNAPSHOT_VERSION, so
+readers should check version (and can check updated to tell whether
+astatus is still running; it is rewritten at least every few seconds).
+
+	const struct astatus_snapshot *shm;
+	struct astatus_snapshot snap;
+
+	shm = astatus_open(getuid());
+	...
+	astatus_read(shm, &snap);
+*/
+
+#ifndef ASTATUS_H
+#define ASTATUS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ASTATUS_SHM "/astatus-%lu" /* and the uid */
+#define ASTATUS_SHM_SIZE 32 /* size of the name (including the '\0') */
+#define ASTATUS_SNAPSHOT_VERSION 1
+
+#define ASTATUS_NAME 32 /* size of names (including the '\0') */
+#define ASTATUS_DISKS 8
+#define ASTATUS_BATTERIES 4
+#define ASTATUS_WIFI 4
+
+/* values of astatus_battery.status */
+enum {
+	ASTATUS_UNKNOWN,
+	ASTATUS_CHARGING,
+	ASTATUS_DISCHARGING,
+	ASTATUS_NOT_CHARGING,
+	ASTATUS_FULL,
+};
+
+struct astatus_disk {
+	char name[ASTATUS_NAME];
+	uint64_t size, avail; /* bytes */
+};
+
+struct astatus_battery {
+	char name[ASTATUS_NAME];
+	int32_t capacity; /* % */
+	int32_t status;
+	int32_t minutesleft; /* until empty (or full if charging), or -1 */
+};
+
+struct astatus_wifi {
+	char name[ASTATUS_NAME];
+	int32_t connected;
+	int32_t signal; /* dBm, if connected */
+	uint32_t bitrate; /* 100 kbit/s, if connected */
+};
+
+struct astatus_snapshot {
+	uint32_t seq;
+	uint32_t version;
+	int64_t updated; /* CLOCK_REALTIME seconds */
+	uint64_t memtotal, memavailable; /* bytes */
+	uint32_t load[3]; /* 1, 5 and 15 minute averages, times 100 */
+	int32_t volume; /* %, or -1 if there is no mixer */
+	int32_t muted;
+	uint32_t ndisks, nbatteries, nwifi;
+	struct astatus_disk disks[ASTATUS_DISKS];
+	struct astatus_battery batteries[ASTATUS_BATTERIES];
+	struct astatus_wifi wifi[ASTATUS_WIFI];
+};
+
+/* Put the name of uid's snapshot in name. */
+static inline void
+astatus_shmname(char name[ASTATUS_SHM_SIZE], uid_t uid)
+{
+	snprintf(name, ASTATUS_SHM_SIZE, ASTATUS_SHM, (unsigned long)uid);
+}
+
+/* Map uid's snapshot. Returns it, or NULL (with errno set) if it isn't
+there, doesn't belong to uid (EPERM) or is too short (EINVAL). */
+static inline const struct astatus_snapshot *
+astatus_open(uid_t uid)
+{
+	int fd;
+	void *p;
+	struct stat st;
+	char name[ASTATUS_SHM_SIZE];
+
+	astatus_shmname(name, uid);
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	/* a short one would fault once it is read past its end */
+	if (st.st_uid != uid
+			|| (size_t)st.st_size < sizeof(struct astatus_snapshot)) {
+		close(fd);
+		errno = st.st_uid != uid ? EPERM : EINVAL;
+		return NULL;
+	}
+	p = mmap(NULL, sizeof(struct astatus_snapshot), PROT_READ, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+/* Copy the snapshot at shm into *snap once it is consistent. Returns 0,
+or -1 if it never was (e.g., astatus died while rewriting it). */
+static inline int
+astatus_read(const struct astatus_snapshot *shm, struct astatus_snapshot *snap)
+{
+	unsigned long tries;
+	uint32_t seq;
+
+	for (tries = 0; tries < 1000000; tries++) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(snap, shm, sizeof(*snap));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+			snap->seq = seq;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#endif /* ASTATUS_H */
@@ -0,0 +1,468 @@
+/*
+astatus benchmark
+
+Times each block's function, and a whole tick (every block plus
+printline), against a fixture tree given as the root (see -r in
+astatus). astatus.c is included with its main renamed so that the
+blocks can be called directly, on the main thread, without the event
+loop or the workers getting in the way.
+
+Besides the time, the number of read(2)-like system calls is taken from
+/proc/self/io, which the kernel keeps for every process. For a complete
+count of all system calls, run astatus under strace -c (see run.sh).
+
+The tick is measured twice: once reading the files one by one, and once
+with them read ahead through the ring first (see ringread), as the main
+loop does where io_uring is available. The ring's io_uring_enter calls
+are counted separately, since they aren't reads.
+
+Heap allocations are counted by wrapping glibc's malloc. Once the disk
+index is built and the string builders have grown, a tick shouldn't
+allocate at all, and the benchmark fails if it does.
+
+The parsers that replaced sscanf are also timed against the sscanf
+calls they replaced, on the fixture's files (already read into memory,
+so only the parsing is measured).
+
+The fixture can't answer netlink requests, so the wifi block is driven
+by a fake wifiops that replays a few link messages, and its segment is
+checked along the way.
+*/
+
+#define main astatusmain
+#include "../astatus.c"
+#undef main
+
+/* Number of times each thing is measured, unless given with -n. */
+#define DEFAULT_TICKS 1000
+
+struct stats {
+	const char *name;
+	double total, min, max; /* microseconds */
+	unsigned long long reads, enters, allocs;
+	unsigned int n;
+};
+
+/* Number of heap allocations so far. */
+static unsigned long long nallocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+	nallocs++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	nallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	nallocs++;
+	return __libc_realloc(ptr, size);
+}
+
+/* Returns the number of read system calls made by this process so far. */
+static unsigned long long
+syscr(void)
+{
+	int fd;
+	ssize_t n;
+	char buf[512], *s;
+
+	fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	s = strstr(buf, "syscr:");
+	return s == NULL ? 0 : strtoull(s + 6, NULL, 10);
+}
+
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6
+			+ (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* Time one call of fn(arg) and add it to *st. Reading /proc/self/io
+costs one read itself, which is taken off. */
+static void
+measure(struct stats *st, void (*fn)(void *), void *arg)
+{
+	double us;
+	unsigned long long reads, enters, allocs;
+	struct timespec start, end;
+
+	reads = syscr();
+	enters = ring.enters;
+	allocs = nallocs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fn(arg);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	st->allocs += nallocs - allocs;
+	st->enters += ring.enters - enters;
+	st->reads += syscr() - reads - 1;
+	us = elapsed(&start, &end);
+	st->total += us;
+	if (st->n == 0 || us < st->min)
+		st->min = us;
+	if (st->n == 0 || us > st->max)
+		st->max = us;
+	st->n++;
+}
+
+static void
+report(const struct stats *st)
+{
+	printf("%-12s %10.1f %10.1f %10.1f %8.1f %8.1f %8.1f\n", st->name,
+			st->total / st->n, st->min, st->max,
+			(double)st->reads / st->n, (double)st->enters / st->n,
+			(double)st->allocs / st->n);
+}
+
+static void
+runone(void *arg)
+{
+	struct block *b = arg;
+
+	sbreset(&b->scratch);
+	b->fn(&b->scratch);
+}
+
+/* What the main loop does when every active block is due, without the
+threads. */
+static void
+tick(void *arg)
+{
+	unsigned int i;
+
+	(void)arg;
+	for (i = 0; i < LEN(blocks); i++) {
+		if (blocks[i].active)
+			runblock(&blocks[i]);
+	}
+	sbreset(&line);
+	printline(&line);
+}
+
+/* The same, with the files read ahead through the ring first. */
+static void
+ringtick(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < LEN(blocks); i++)
+		blocks[i].fetch = blocks[i].active;
+	ringread(fetching);
+	tick(arg);
+}
+
+static void
+reindex(void *arg)
+{
+	(void)arg;
+	indexdisks();
+}
+
+/* Call the function pointed to by arg 100 times. */
+static void
+callhundred(void *arg)
+{
+	void (*fn)(void *) = *(void (**)(void *))arg;
+	int i;
+
+	for (i = 0; i < 100; i++)
+		fn(NULL);
+}
+
+/*
+Fake netlink: links come and go as in fakelinks, and wlan0 is connected.
+The first read replays every message; later ones only repeat the
+messages of links that didn't change (or aren't wireless), which
+shouldn't refresh anything.
+*/
+
+static const struct {
+	int index;
+	const char *name;
+	int operstate; /* -1 if removed */
+	int again; /* repeated by later reads */
+} fakelinks[] = {
+	{ 2, "veth0", IF_OPER_UP, 1 },
+	{ 3, "wlan0", IF_OPER_DORMANT, 0 },
+	{ 3, "wlan0", IF_OPER_UP, 1 },
+	{ 4, "wlan1", IF_OPER_UP, 0 },
+	{ 4, "wlan1", -1, 0 }, /* unplugged... */
+	{ 5, "wlan1", IF_OPER_DORMANT, 1 }, /* ...and plugged back in */
+	{ 6, "veth1", IF_OPER_DOWN, 1 },
+};
+static int fakereads;
+
+static int
+fakeopenlinks(void)
+{
+	return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+static int
+fakerequestlinks(int fd)
+{
+	(void)fd;
+	return 0;
+}
+
+static int
+fakereadlinks(int fd, int (*setlink)(int, const char *, int))
+{
+	unsigned int i;
+	int changed;
+
+	(void)fd;
+	for (i = 0, changed = 0; i < LEN(fakelinks); i++) {
+		if (fakereads == 0 || fakelinks[i].again)
+			changed |= setlink(fakelinks[i].index,
+					fakelinks[i].name,
+					fakelinks[i].operstate);
+	}
+	fakereads++;
+	return changed;
+}
+
+static int
+fakestation(int index, int *signal, unsigned int *bitrate)
+{
+	if (index != 3)
+		return -1;
+	*signal = -52;
+	*bitrate = 8665;
+	return 0;
+}
+
+static const struct wifiops fakewifiops = {
+	.openlinks = fakeopenlinks,
+	.requestlinks = fakerequestlinks,
+	.readlinks = fakereadlinks,
+	.station = fakestation,
+};
+
+/* Check the wifi block's segment after the fake's messages, and that
+repeating them doesn't refresh it. Returns 0, or -1 if either is off. */
+static int
+checkwifi(void)
+{
+	static const char want[] = "wlan0 -52dBm 866M" SEPARATOR
+			"wlan1 dormant";
+	struct strbuf sb = {0};
+
+	if (!devfind(&wirelessdevs, "wlan0")
+			|| !devfind(&wirelessdevs, "wlan1")) {
+		printf("fixture lacks wlan0 or wlan1, not checking wifi\n");
+		return 0;
+	}
+	sbreset(&sb);
+	wifi(&sb);
+	if (strcmp(sb.s, want) != 0) {
+		fprintf(stderr, "%s: wifi is \"%s\", not \"%s\"\n", argv0,
+				sb.s, want);
+		free(sb.s);
+		return -1;
+	}
+	free(sb.s);
+	if (onlinks(linkfd, EPOLLIN) != 0) {
+		fprintf(stderr, "%s: unchanged links refreshed wifi\n",
+				argv0);
+		return -1;
+	}
+	printf("wifi:%s\n", want);
+	return 0;
+}
+
+/* The file contents the parser benchmarks work on. */
+static char meminfo[4096], uevent[2048];
+/* Sinks for the parsed values, so the parsing isn't optimized out. */
+static volatile unsigned long sink;
+
+static void
+memgetfield(void *arg)
+{
+	unsigned long total, available;
+
+	(void)arg;
+	if (getfield(meminfo, "MemTotal:", &total) == 0
+			&& getfield(meminfo, "MemAvailable:", &available) == 0)
+		sink = total - available;
+}
+
+static void
+memsscanf(void *arg)
+{
+	unsigned long total, free, available;
+
+	(void)arg;
+	if (sscanf(meminfo, "MemTotal: %lu kB MemFree: %lu kB "
+			"MemAvailable: %lu kB ", &total, &free,
+			&available) == 3)
+		sink = total - available;
+}
+
+static void
+capgetfield(void *arg)
+{
+	unsigned long n;
+
+	(void)arg;
+	if (getfield(uevent, "POWER_SUPPLY_CAPACITY=", &n) == 0)
+		sink = n;
+}
+
+static void
+capsscanf(void *arg)
+{
+	int n;
+	const char *s;
+
+	(void)arg;
+	if ((s = strstr(uevent, "\nPOWER_SUPPLY_CAPACITY=")) != NULL
+			&& sscanf(s, " POWER_SUPPLY_CAPACITY=%d", &n) == 1)
+		sink = (unsigned long)n;
+}
+
+/* Time each parser and the sscanf call it replaced, calling each one
+100 times per measurement, since a single call is too quick to time. */
+static void
+benchparsers(unsigned int ticks)
+{
+	static const struct {
+		const char *name;
+		void (*fn)(void *);
+	} parsers[] = {
+		{ "meminfo", memgetfield },
+		{ "  sscanf", memsscanf },
+		{ "capacity", capgetfield },
+		{ "  sscanf", capsscanf },
+	};
+	unsigned int i, j;
+	struct stats st;
+
+	if (readfile("/proc/meminfo", meminfo, sizeof(meminfo)) < 0
+			|| readfile(BATTERY_PREFIX "BAT0/uevent", uevent,
+				sizeof(uevent)) < 0) {
+		printf("fixture lacks meminfo or BAT0, not timing parsers\n");
+		return;
+	}
+	printf("%-12s %10s %10s %10s (per 100 calls)\n", "", "mean us",
+			"min us", "max us");
+	for (i = 0; i < LEN(parsers); i++) {
+		memset(&st, 0, sizeof(st));
+		st.name = parsers[i].name;
+		for (j = 0; j < ticks; j++)
+			measure(&st, callhundred, (void *)&parsers[i].fn);
+		printf("%-12s %10.1f %10.1f %10.1f\n", st.name,
+				st.total / st.n, st.min, st.max);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, failed;
+	unsigned int j, ticks;
+	unsigned long long allocs;
+	struct stats st;
+
+	argv0 = argv[0];
+	ticks = DEFAULT_TICKS;
+	for (i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 2 < argc)
+			ticks = strtoul(argv[++i], NULL, 10);
+		else
+			break;
+	}
+	if (i != argc - 1 || ticks == 0) {
+		fprintf(stderr, "usage: %s [-n ticks] root\n", argv[0]);
+		return 1;
+	}
+	root = argv[i];
+
+	/* The same setup as astatus, minus the workers and the sockets,
+	and with the fake netlink. */
+	if ((errno = pthread_key_create(&ownerkey, NULL)) != 0)
+		die("pthread_key_create:");
+	setupevents();
+	watchmounts();
+	if (mounts == NULL)
+		die("%s/proc/mounts:", root);
+	scandevices();
+	wifiops = &fakewifiops;
+	watchlinks();
+	probeblocks();
+	failed = checkwifi() < 0;
+
+	indexdisks();
+	printf("root %s, %u ticks, %zu disks indexed\n", root, ticks,
+			ndisks);
+	printf("%-12s %10s %10s %10s %8s %8s %8s\n", "", "mean us", "min us",
+			"max us", "reads", "enters", "allocs");
+	for (j = 0; j < LEN(blocks); j++) {
+		if (!blocks[j].active) {
+			printf("%-12s inactive\n", blocks[j].name);
+			continue;
+		}
+		memset(&st, 0, sizeof(st));
+		st.name = blocks[j].name;
+		for (i = 0; (unsigned int)i < ticks; i++)
+			measure(&st, runone, &blocks[j]);
+		report(&st);
+	}
+	memset(&st, 0, sizeof(st));
+	st.name = "indexdisks";
+	for (i = 0; (unsigned int)i < ticks; i++)
+		measure(&st, reindex, NULL);
+	report(&st);
+	/* a fixture's /proc/mounts can't be watched, so pretend it is, as
+	it would be on a real system where the mounts don't change */
+	mountswatched = 1;
+	mountsdirty = 1;
+	tick(NULL);
+	memset(&st, 0, sizeof(st));
+	st.name = "tick";
+	for (i = 0; (unsigned int)i < ticks; i++)
+		measure(&st, tick, NULL);
+	report(&st);
+	allocs = st.allocs;
+	/* the first batch sizes the read-ahead buffers */
+	openring();
+	if (ring.fd >= 0) {
+		ringtick(NULL);
+		memset(&st, 0, sizeof(st));
+		st.name = "tick ring";
+		for (i = 0; (unsigned int)i < ticks; i++)
+			measure(&st, ringtick, NULL);
+		report(&st);
+		allocs += st.allocs;
+	} else {
+		printf("%-12s unavailable\n", "tick ring");
+	}
+	printf("line:%s\n", line.s);
+	benchparsers(ticks);
+	if (allocs > 0) {
+		fprintf(stderr, "%s: ticks made %llu heap allocations\n",
+				argv0, allocs);
+		failed = 1;
+	}
+	return failed;
+}
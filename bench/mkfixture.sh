@@ -0,0 +1,69 @@
+#!/bin/sh
+# Generate a large fixture tree (like a container host with a docking
+# station full of batteries) from the small one that is checked in:
+# 5,000 more mounts, most of them bind mounts and overlays, their disks'
+# statistics, 200 container network interfaces, and 64 power supplies.
+#
+# usage: mkfixture.sh small big
+set -e
+
+small=${1:-bench/root}
+big=${2:-bench/big}
+
+rm -rf "$big"
+cp -R "$small" "$big"
+
+# 40 real disks, each mounted once under /mnt and then bind-mounted
+# 50 times into containers; the rest are overlays and tmpfs that are
+# ignored.
+awk -v big="$big" 'BEGIN {
+	n = 0
+	for (d = 0; d < 40; d++) {
+		dev = sprintf("/dev/vd%c%d", 97 + d % 26, d / 26 + 1)
+		devs[d] = dev
+		printf "" > (big dev)
+		system("mkdir -p " big "/mnt/disk" d)
+		printf "%s /mnt/disk%d ext4 rw,relatime 0 0\n", dev, d
+		n++
+	}
+	for (c = 0; n < 5000; c++) {
+		printf "overlay /var/lib/containers/%d/merged overlay rw,relatime,lowerdir=/l,upperdir=/u,workdir=/w 0 0\n", c
+		printf "tmpfs /var/lib/containers/%d/merged/run tmpfs rw,nosuid,nodev 0 0\n", c
+		n += 2
+		for (b = 0; b < 2 && n < 5000; b++) {
+			printf "%s /var/lib/containers/%d/merged/data%d ext4 rw,relatime 0 0\n", devs[(c + b) % 40], c, b
+			n++
+		}
+	}
+}' >>"$big/proc/mounts"
+
+awk 'BEGIN {
+	for (d = 0; d < 40; d++)
+		printf "%4d %7d vd%c%d %d 0 %d %d %d 0 %d %d 0 %d %d 0 0 0 0 0 0\n", 252, d, 97 + d % 26, d / 26 + 1, d * 1000, d * 8000, d * 10, d * 500, d * 4000, d * 5, d * 12, d * 15
+}' >>"$big/proc/diskstats"
+
+awk 'BEGIN {
+	for (i = 0; i < 200; i++)
+		printf "veth%d: %d %d 0 0 0 0 0 0 %d %d 0 0 0 0 0 0\n", i, i * 1500, i, i * 700, i
+}' >>"$big/proc/net/dev"
+
+# 62 more batteries next to BAT0 and AC, like game controllers and other
+# peripherals, which only report a capacity and a status.
+i=1
+while [ "$i" -lt 63 ]; do
+	d="$big/sys/class/power_supply/BAT$i"
+	mkdir -p "$d"
+	if [ $((i % 3)) -eq 0 ]; then
+		status=Charging
+	else
+		status=Discharging
+	fi
+	cat >"$d/uevent" <<-EOF
+	POWER_SUPPLY_NAME=BAT$i
+	POWER_SUPPLY_TYPE=Battery
+	POWER_SUPPLY_STATUS=$status
+	POWER_SUPPLY_PRESENT=1
+	POWER_SUPPLY_CAPACITY=$((i * 7 % 100))
+	EOF
+	i=$((i + 1))
+done
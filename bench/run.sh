@@ -0,0 +1,23 @@
+#!/bin/sh
+# Benchmark astatus against each fixture tree, and count its system
+# calls for one refresh if strace is installed.
+#
+# usage: run.sh [-n ticks] root...
+set -e
+
+ticks=
+if [ "$1" = -n ]; then
+	ticks="-n $2"
+	shift 2
+fi
+
+for root; do
+	root=$(cd "$root" && pwd)
+	bench/bench $ticks "$root"
+	if command -v strace >/dev/null; then
+		strace -c -f ./astatus -1 -s -r "$root" >/dev/null
+	else
+		echo "strace not found, not counting system calls"
+	fi
+	echo
+done
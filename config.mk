@@ -2,17 +2,23 @@
 PREFIX ?= /usr/share
 BINDIR ?= $(PREFIX)/bin
 MANDIR ?= $(PREFIX)/man
+INCDIR ?= $(PREFIX)/include
 
 # flags (the "necessary" ones are in the makefile)
 CFLAGS ?= -g -Os
 CPPFLAGS ?=
 LDFLAGS ?=
 LDLIBS ?= -lc
+# shm_open (for the snapshot) is in librt before glibc 2.34, and librt is
+# an empty stub after it; astatus-read only needs this
+RTLIBS = -lrt
+LDLIBS += $(RTLIBS)
 
-# x11 support: to disable, call make with NOX=1 or comment out this block
+# x11 support (through xcb): to disable, call make with NOX=1 or comment
+# out this block
 ifneq ($(NOX),1)
 CPPFLAGS += -DX
-LDLIBS += -lX11
+LDLIBS += -lxcb
 endif
 
 # alsa support: to disable, call make with NOALSA=1 or comment out this block
@@ -20,3 +26,31 @@ ifneq ($(NOALSA),1)
 CPPFLAGS += -DALSA
 LDLIBS += -lasound
 endif
+
+# blocks: to leave one out completely, call make with its flag (e.g.,
+# NOWIFI=1 or NOBATTERIES=1); NODISKS=1 leaves out io too, since io shows
+# the disks that disks finds mounted
+ifeq ($(NOWIFI),1)
+CPPFLAGS += -DNOWIFI
+endif
+ifeq ($(NONET),1)
+CPPFLAGS += -DNONET
+endif
+ifeq ($(NODISKS),1)
+CPPFLAGS += -DNODISKS
+endif
+ifeq ($(NOIO),1)
+CPPFLAGS += -DNOIO
+endif
+ifeq ($(NOPRESSURE),1)
+CPPFLAGS += -DNOPRESSURE
+endif
+ifeq ($(NOBATTERIES),1)
+CPPFLAGS += -DNOBATTERIES
+endif
+
+# io_uring read-ahead (falls back to pread(2) when the kernel lacks it): to
+# disable, call make with NOURING=1
+ifeq ($(NOURING),1)
+CPPFLAGS += -DNOURING
+endif